@@ -4,16 +4,25 @@
 // Euclidean point set (all-connected graph implied)
 #include "square_symmetric_matrix.hh"
 #include "graph.hh"
-template <typename T=double>
-class Euclidean_set : public graph<T> {
+#include <utility>
+// The default table is row-padded and aligned, so the distance lookups
+// of a search step touch as few cache lines as possible. Very large
+// sets can use packed_symmetric_matrix<T> instead.
+template < typename T=double, typename Table=padded_symmetric_matrix<T> >
+class Euclidean_set : public basic_graph<Euclidean_set<T,Table>, T> {
 public:
-  typedef graph<T> graph_type;
-  typedef square_symmetric_matrix<T> table_type;
-  typedef typename graph_type::size_type size_type;
-  typedef typename graph_type::index_type index_type;
-  typedef typename graph_type::value_type value_type;
+  typedef basic_graph<Euclidean_set<T,Table>, T> base_type;
+  typedef Table table_type;
+  typedef typename base_type::size_type size_type;
+  typedef typename base_type::index_type index_type;
+  typedef typename base_type::value_type value_type;
 
-  Euclidean_set(const table_type& t) : table(t) { }
+  // Takes a copy of a distance table in any storage layout
+  template <typename C, typename L>
+  Euclidean_set(const square_symmetric_matrix<T,C,L> &t) : table(t) { }
+
+  // Takes over a table of the right type (e.g. a mapped one) as is
+  Euclidean_set(table_type &&t) : table(std::move(t)) { }
 
   size_type size() const
   { return table.size(); }
@@ -34,21 +43,44 @@ public:
   value_type distance(index_type i, index_type j) const
   { return table(i, j); }
 
+  // out[a] = distance(i, nodes[a]) for a < m
+  void distances(index_type i, const index_type *nodes, size_type m, value_type *out) const
+  { for (size_type a=0; a<m; a++) out[a] = table(i, nodes[a]); }
+
+  // out[j-first] = distance(i, j) for first <= j < last
+  void range_distances(index_type i, index_type first, index_type last, value_type *out) const
+  { for (index_type j=first; j<last; j++) out[j-first] = table(i, j); }
+
+  // Change the distance between nodes i and j
+  void set_distance(index_type i, index_type j, value_type d)
+  { table.set(i, j, d); }
+
 private:
   table_type table;
 };
 
 // Hamiltonian search path through a graph -- implied tree
+//
+// p holds a permutation of the nodes: the path is p[0, global_level()]
+// and the rest are the open nodes, in no particular order. The children
+// of a node are the open nodes, taken nearest first along the candidate
+// lists if there are any (and in index order after those), so moving
+// between children only swaps entries of p. Every step up, down or to
+// the next sibling takes constant time apart from finding the child.
 #include "path.hh"
 #include "tree.hh"
+#include "searchrecord_impl.hh"
+#include "candidate_impl.hh"
 #include <vector>
-#include <stack>
 #include <algorithm>
-template <typename T=double>
-class EH_search_path : public path< T, std::vector<std::size_t> >, public tree {
+#include <numeric>
+template < typename T=double, typename G=Euclidean_set<T> >
+class EH_search_path :
+    public basic_path< EH_search_path<T,G>, T, std::vector<std::size_t> >,
+    public basic_tree< EH_search_path<T,G> > {
 public:
-  typedef path< T, std::vector<std::size_t> > base_type;
-  typedef Euclidean_set<T> graph_type;
+  typedef basic_path< EH_search_path<T,G>, T, std::vector<std::size_t> > base_type;
+  typedef G graph_type;
   typedef typename base_type::size_type size_type;
   typedef typename base_type::index_type index_type;
   typedef typename base_type::value_type value_type;
@@ -57,31 +89,53 @@ public:
   typedef typename base_type::const_reverse_iterator const_reverse_iterator;
 
   typedef std::ptrdiff_t difference_type;
+  typedef search_record<T> record_type;
+  typedef candidate_lists<graph_type> candidates_type;
 
   // Forward declaration of Euclidean_path type below this
   // template <typename V=double> class Euclidean_path;
   template <typename V> friend class Euclidean_path;
 
-  template <typename V> friend EH_search_path<V> longest_path(const Euclidean_set<V> &g);
+  // The traversal and the virtual adapters call the private primitives
+  friend class basic_tree<EH_search_path>;
+  friend class path_adapter<EH_search_path>;
+  friend class tree_adapter<EH_search_path>;
+
+  template <typename H> friend
+  EH_search_path<typename H::value_type, H> longest_path(const H &g);
 
   // Initialize
-  EH_search_path(const graph_type &g, index_type gi) :
-    rsize(0), tlevel(0), local(), p(g.size()),
-    total_distance(value_type()), mygraph(g) {
-    init_path(); init_local();
-    std::copy(p.begin(), p.begin()+gi, p.begin()+1);
-    p[0] = gi;
+  EH_search_path(const graph_type &g, index_type gi, path_mode m=fixed_start) :
+    rsize(0), tlevel(0), frame(g.size()+1), p(g.size()), pos(g.size()),
+    visited(g.size(), 0), total_distance(value_type()), pmode(m),
+    cand(nullptr), above(0), mygraph(g) {
+    init_path();
+    std::rotate(p.begin(), p.begin()+gi, p.begin()+gi+1);
+    init_state();
   }
 
   // Create empty
-  EH_search_path(const graph_type &g) :
-    rsize(0), tlevel(0), local(), p(g.size()),
-    total_distance(0), mygraph(g) { init_path(); init_local(); }
+  EH_search_path(const graph_type &g, path_mode m=fixed_start) :
+    rsize(0), tlevel(0), frame(g.size()+1), p(g.size()), pos(g.size()),
+    visited(g.size(), 0), total_distance(0), pmode(m),
+    cand(nullptr), above(0), mygraph(g)
+  { init_path(); init_state(); }
+
+  // Complete path visiting the nodes in the given order
+  EH_search_path(const graph_type &g, const container_type &order, path_mode m=fixed_start) :
+    rsize(g.size()-1), tlevel(0), frame(g.size()+1), p(order), pos(g.size()),
+    visited(g.size(), 0), total_distance(value_type()), pmode(m),
+    cand(nullptr), above(0), mygraph(g) {
+    init_state();
+    for (index_type i=1; i<p.size(); i++) total_distance += mygraph.distance(p[i-1], p[i]);
+    if (pmode == closed_tour) total_distance += mygraph.distance(p.back(), p.front());
+  }
 
   // Copy
   EH_search_path(const EH_search_path &pa) :
-    rsize(pa.rsize), tlevel(pa.tlevel), local(pa.local), p(pa.p),
-    total_distance(pa.total_distance), mygraph(pa.mygraph) { }
+    rsize(pa.rsize), tlevel(pa.tlevel), frame(pa.frame), p(pa.p), pos(pa.pos),
+    visited(pa.visited), total_distance(pa.total_distance), pmode(pa.pmode),
+    cand(pa.cand), above(pa.above), mygraph(pa.mygraph) { }
 
   // p.size() is always strictly positive, so returning unsigned is OK
   size_type size() const { return global_level() + 1; }
@@ -98,15 +152,78 @@ public:
 
   size_type global_level() const { return rsize + tlevel; }
 
-  // Split tree
-  EH_search_path split() {
-    EH_search_path nsp(mygraph);
-    nsp.rsize = global_level();
-    nsp.p = p;
-    nsp.local.push(whoami());
-    nsp.total_distance = total_distance;
-    next_branch();
-    return nsp;
+  // Last node on the path
+  index_type back() const { return p[global_level()]; }
+
+  // Nodes not yet on the path (in no particular order)
+  const_iterator remaining_begin() const { return end(); }
+  const_iterator remaining_end() const { return p.end(); }
+
+  path_mode mode() const { return pmode; }
+
+  // Expand children nearest first along c (which must outlive the
+  // path); without candidate lists children come in index order
+  void use_candidates(const candidates_type *c) { cand = c; }
+
+  // Symmetry breaking for free paths and tours, which are the same
+  // read backwards: only the orientation whose last node is above an
+  // anchor (the first node of a free path, the second of a tour) is
+  // searched. True if no completion of this path has that orientation.
+  bool mirrored() const {
+    if (pmode == fixed_start) return false;
+    const size_type gl = global_level();
+    if (gl < anchor()) return false;
+    if (gl + 1 == p.size()) return p[gl] < p[anchor()];
+    return above == 0;
+  }
+
+  // Split tree: hand the subtree below the current node to rec (sized
+  // for size() nodes) and move on to the next branch
+  void split(record_type &rec) {
+    rec.assign(begin(), end(), total_distance);
+    this->next_branch();
+  }
+
+  // Rebuild as the root of the subtree described by rec. The nodes are
+  // swapped into place, so this allocates nothing.
+  void assign(const record_type &rec) {
+    std::fill(visited.begin(), visited.end(), 0);
+    index_type i = 0;
+    for (typename record_type::const_iterator it=rec.begin(); it != rec.end(); ++it, ++i) {
+      place(*it, i);
+      visited[*it] = 1;
+    }
+    rsize = rec.size() - 1;
+    tlevel = 0;
+    frame[0] = level_frame();
+    total_distance = rec.weight();
+    if (pmode != fixed_start && rsize >= anchor()) count_above();
+    if (rec.first_child() > 0) enqueue(rec.first_child());
+  }
+
+  // Work donation: the shallowest level below the root of this path
+  // whose parent has children left to visit after the current one, and
+  // at least min_open open nodes (0 if there is none)
+  size_type donor_level(size_type min_open) const {
+    for (size_type l=1; l<=tlevel; l++) {
+      if (p.size() - rsize - l < min_open) break; // children of the parent
+      if (has_later_siblings(l)) return l;
+    }
+    return 0;
+  }
+
+  // True if the parent at level l has children left to visit after the
+  // current one (1 <= l <= level())
+  bool has_later_siblings(size_type l) const
+  { return !frame[l].closed && frame[l].child + 1 < p.size() - rsize - l; }
+
+  // Hand the children after the current one at level l to rec, sized
+  // for the parent's path (size() - level() + l - 1 nodes); this path
+  // skips them from now on
+  void donate(size_type l, record_type &rec) {
+    rec.assign(p.begin(), p.begin() + rsize + l, frame[l-1].weight);
+    rec.set_first_child(frame[l].child + 1);
+    frame[l].closed = 1;
   }
 
   // This is needed to get around the non-copyable behavior due to the
@@ -114,9 +231,14 @@ public:
   EH_search_path& operator=(const EH_search_path &other) {
     rsize = other.rsize;
     tlevel = other.tlevel;
+    frame = other.frame;
     p = other.p;
-    local = other.local;
+    pos = other.pos;
+    visited = other.visited;
     total_distance = other.total_distance;
+    pmode = other.pmode;
+    cand = other.cand;
+    above = other.above;
     // mygraph = other.mygraph;
     return *this;
   }
@@ -127,10 +249,82 @@ public:
   const graph_type& graph() const { return mygraph; }
 
 private:
-  typedef std::stack<index_type> stack_type;
+  // Search state of a tree level: the child number, its position in the
+  // child enumeration, whether its remaining siblings were donated, and
+  // the path weight at this level (saved when descending, so going back
+  // up restores it exactly). One frame per level is allocated up front.
+  struct level_frame {
+    level_frame() : child(0), cursor(0), weight(), closed(0) { }
+    index_type child, cursor;
+    value_type weight;
+    char closed;
+  };
 
   void init_path() { std::iota(p.begin(), p.end(), 0); }
-  void init_local() { local.push(0); }
+
+  // Positions, visited flags and the mirror count for the current p
+  void init_state() {
+    for (index_type i=0; i<p.size(); i++) pos[p[i]] = i;
+    std::fill(visited.begin(), visited.end(), 0);
+    for (index_type i=0; i<=global_level() && i<p.size(); i++) visited[p[i]] = 1;
+    if (pmode != fixed_start && global_level() >= anchor()) count_above();
+  }
+
+  // Move node gi to position i of p
+  void place(index_type gi, index_type i) {
+    const index_type j = pos[gi];
+    std::swap(p[i], p[j]);
+    pos[p[i]] = i;
+    pos[p[j]] = j;
+  }
+
+  // Position of the node mirrored() compares against, and the number of
+  // open nodes above it, kept up to date as nodes come and go
+  size_type anchor() const { return (pmode == free_start) ? 0 : 1; }
+
+  void count_above() {
+    const index_type a = p[anchor()];
+    above = 0;
+    for (const_iterator it=remaining_begin(); it != remaining_end(); ++it) above += (*it > a);
+  }
+
+  // Children of the last node are enumerated along a sequence: first the
+  // candidate list of the last node, then all nodes in index order
+  // (skipping those on the list). child_node(s) is entry s of it, and
+  // s is a child if that node is still open.
+  size_type num_candidates() const { return cand ? cand->size() : 0; }
+
+  index_type child_node(index_type last, index_type s) const
+  { return (s < num_candidates()) ? cand->begin(last)[s] : s - num_candidates(); }
+
+  bool is_child(index_type last, index_type s) const {
+    const index_type gi = child_node(last, s);
+    return !visited[gi] && (s < num_candidates() || !cand || !cand->contains(last, gi));
+  }
+
+  // Put open node gi at the end of the path (position global_level()),
+  // whose parent weight is in the frame above
+  void visit(index_type gi) {
+    const size_type gl = global_level();
+    place(gi, gl);
+    visited[gi] = 1;
+    total_distance = frame[tlevel-1].weight + mygraph.distance(p[gl-1], gi);
+    // A complete tour returns to its first node
+    if (pmode == closed_tour && gl+1 == p.size())
+      total_distance += mygraph.distance(gi, p[0]);
+    if (pmode != fixed_start) {
+      if (gl == anchor()) count_above();
+      else if (gl > anchor() && gi > p[anchor()]) above--;
+    }
+  }
+
+  // Take the last node off the path
+  void leave() {
+    const size_type gl = global_level();
+    const index_type gi = p[gl];
+    visited[gi] = 0;
+    if (pmode != fixed_start && gl > anchor() && gi > p[anchor()]) above++;
+  }
 
   /* path implementation */
   size_type num_neighbor() const { return num_children(); }
@@ -138,57 +332,81 @@ private:
   index_type neighbor(index_type ti) const { return p[global_level() + 1 + ti]; }
 
   /* tree implementation */
-  size_type whoami() const { return local.top(); }
+  size_type whoami() const { return frame[tlevel].child; }
 
   // The first part is always non-negative so this is safe
   size_type num_children() const
   { return (mygraph.size() - global_level() - 1) % mygraph.size(); }
 
+  // Child i is found by counting along the enumeration
   void enqueue(index_type i) {
 #ifndef NDEBUG
     if (i >= num_children()) throw std::runtime_error("Invalid child");
 #endif
-    const size_type gl = global_level();
-    const index_type gi = neighbor(i);
-    std::copy(p.begin()+gl+1, p.begin()+gl+1+i, p.begin()+gl+2);
-    p[gl+1] = gi;
-    total_distance += mygraph.distance(p[gl], p[gl+1]);
+    const index_type last = p[global_level()];
+    index_type s = 0, skip = i;
+    for (;; s++)
+      if (is_child(last, s)) {
+        if (skip == 0) break;
+        skip--;
+      }
+    frame[tlevel].weight = total_distance;
     tlevel++;
-    local.push(i);
+    level_frame &f = frame[tlevel];
+    f.child = i;
+    f.cursor = s;
+    f.closed = 0;
+    visit(child_node(last, s));
   }
 
   void dequeue() {
 #ifndef NDEBUG
-    if (is_top()) throw std::runtime_error("No parent");
+    if (this->is_top()) throw std::runtime_error("No parent");
 #endif
-    const index_type i = whoami();
-    const size_type gl = global_level();
-    const index_type gi = p[gl];
-    total_distance -= mygraph.distance(p[gl-1], p[gl]);
-    std::copy_backward(p.begin()+gl+1, p.begin()+gl+1+i, p.begin()+gl+i);
-    p[gl+i] = gi;
+    leave();
     tlevel--;
-    local.pop();
+    total_distance = frame[tlevel].weight;
+  }
+
+  // The next child continues the enumeration where this one was found
+  void next_sibling() {
+#ifndef NDEBUG
+    if (!has_next_sibling()) throw std::runtime_error("Next child does not exist");
+#endif
+    leave();
+    const index_type last = p[global_level() - 1];
+    level_frame &f = frame[tlevel];
+    index_type s = f.cursor + 1;
+    while (!is_child(last, s)) s++;
+    f.child++;
+    f.cursor = s;
+    visit(child_node(last, s));
   }
 
-  bool has_next_sibling() { return whoami() < num_sibling(); }
+  bool has_next_sibling() { return !frame[tlevel].closed && whoami() < num_sibling(); }
 
   size_type num_sibling() const
   { return num_children() % (mygraph.size() - rsize - 1); }
 
   index_type rsize, tlevel;
-  stack_type local;
-  container_type p;
+  std::vector<level_frame> frame;
+  container_type p, pos;
+  std::vector<char> visited;
   value_type total_distance;
+  path_mode pmode;
+  const candidates_type *cand;
+  // Open nodes above the anchor (free paths and tours)
+  size_type above;
   const graph_type &mygraph;
 };
 
 
 #include <limits>
-template <typename V>
-EH_search_path<V> longest_path(const Euclidean_set<V> &g) {
-  EH_search_path<V> sp(g);
-  sp.total_distance = std::numeric_limits<typename EH_search_path<V>::value_type>::max();
+template <typename G>
+EH_search_path<typename G::value_type, G> longest_path(const G &g) {
+  typedef EH_search_path<typename G::value_type, G> spath_type;
+  spath_type sp(g);
+  sp.total_distance = std::numeric_limits<typename spath_type::value_type>::max();
   return sp;
 }
 
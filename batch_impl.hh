@@ -0,0 +1,222 @@
+#ifndef BATCH_IMPL_HH
+#define BATCH_IMPL_HH
+
+// Batches of many small graphs. Parallel searches do not pay off below
+// a few dozen nodes: setting up the search and a team of threads costs
+// more than searching. A batch_solver instead solves small graphs one
+// per thread, each with a sequential branch-and-bound search in scratch
+// kept from one graph to the next, and gives the few larger ones the
+// parallel search of solve() one at a time.
+#include <omp.h>
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+
+#include "solve_impl.hh"
+
+// Largest graph searched on a single thread (the node count of the
+// batch kernels)
+constexpr index_type batch_kernel_max = 16;
+
+// Largest graph the automatic engine choice gives to the dynamic
+// program in a batch. On one thread the search overtakes it sooner than
+// dp_auto_max.
+constexpr index_type batch_dp_max = 10;
+
+// Sequential depth-first search of the subtree below sp for paths
+// lighter than best * keep. Each one found becomes best and is copied to
+// order. Returns the number of nodes checked.
+template <typename P>
+std::size_t find_path_sequential(P &sp, path_bound<P> &bound, const double keep,
+                                 typename P::value_type &best, std::size_t *order) {
+  typedef typename P::value_type value_type;
+  std::size_t nodes = 0;
+  value_type cutoff = best * keep;
+  do {
+    sp.iterate_dfs();
+    while (!sp.is_top() && (nodes++, sp.mirrored() || bound(sp, cutoff) > cutoff))
+      sp.next_branch();
+    if (sp.is_top()) break;
+    if (sp.is_bottom() && sp.weight() < best) {
+      best = sp.weight();
+      cutoff = best * keep;
+      std::copy(sp.begin(), sp.end(), order);
+    }
+  } while (!sp.is_top());
+  return nodes;
+}
+
+// One thread's scratch for graphs of up to N nodes: the distances, the
+// candidate lists, the bound and the local search of the seed, all sized
+// for N when the worker is made and reloaded for every graph, and the
+// dynamic program's table, which grows to the largest graph it was used
+// for. The engine is picked as by solve(), up to batch_dp_max.
+template <typename T, std::size_t N>
+class batch_worker {
+public:
+  typedef fixed_set<T,N> graph_type;
+  typedef typename search_types<graph_type>::spath_type spath_type;
+  typedef typename search_types<graph_type>::bound_type bound_type;
+  typedef T value_type;
+
+  explicit batch_worker(const solve_options &opt) :
+    fg(), bound(make_bound(opt.bound, fg)),
+    cand(opt.nearest_first ? new candidate_lists<graph_type>(fg, opt.candidates) : nullptr),
+    polish(fg, std::vector<std::size_t>(N), opt.mode), table(1), engine(opt.engine),
+    dp_memory(opt.dp_memory), restarts(opt.restarts), candidates(opt.nearest_first ? opt.candidates : 0),
+    mode(opt.mode), keep(1 - opt.gap) { }
+
+  // Write the order of the lightest path through g (of at most N nodes)
+  // to order; nodes counts the search nodes checked
+  template <typename G>
+  void solve(const G &g, std::size_t *order, std::size_t &nodes) {
+    const std::size_t n = g.size();
+    if (n < 2) {
+      std::iota(order, order + n, 0);
+      return;
+    }
+    const bool fits = held_karp_fits(g, dp_memory, mode);
+    if (engine == dp_engine && !fits)
+      throw std::runtime_error("Dynamic program exceeds the memory limit (--dp-memory)");
+    if (engine == heuristic_engine) {
+      const std::vector<std::size_t> o = lk_order(g, restarts, candidates, mode);
+      std::copy(o.begin(), o.end(), order);
+      return;
+    }
+    if (engine == dp_engine || (engine == auto_engine && n <= batch_dp_max && fits)) {
+      held_karp_order(g, 0, mode, table, order, false);
+      return;
+    }
+    fg.load(g);
+    bound->reset();
+    if (cand) cand->rebuild();
+    // The seed is the first of seed_path()'s restarts: the
+    // nearest-neighbour path, locally optimised
+    value_type best = std::numeric_limits<value_type>::max();
+    if (restarts > 0) {
+      nearest_neighbour_order(fg, 0, order);
+      if (n >= 3) {
+        polish.assign(order, order + n);
+        polish.optimise();
+        polish.order(order);
+      }
+      best = value_type();
+      for (std::size_t i=1; i<n; i++) best += fg.distance(order[i-1], order[i]);
+      if (mode == closed_tour) best += fg.distance(order[n-1], order[0]);
+    }
+    const std::size_t nroot = (mode == free_start) ? n - 1 : 1;
+    for (std::size_t r=0; r<nroot; r++) {
+      spath_type sp(fg, r, mode);
+      sp.use_candidates(cand.get());
+      nodes += find_path_sequential(sp, *bound, keep, best, order);
+    }
+  }
+
+private:
+  graph_type fg;
+  std::unique_ptr<bound_type> bound;
+  std::unique_ptr< candidate_lists<graph_type> > cand;
+  local_search_cycle<graph_type> polish;
+  held_karp_table<value_type> table;
+  engine_kind engine;
+  std::size_t dp_memory;
+  index_type restarts, candidates;
+  path_mode mode;
+  double keep;
+};
+
+// Solves batches of graphs of type G with the same options. Keep one
+// solver for many batches: its per-thread scratch and result buffers
+// are reused, so batches of small graphs cost no allocation apart from
+// the answers themselves. Checkpoints, time limits and distributed
+// searches are for single solves; on_incumbent is not called.
+template <typename G>
+class batch_solver {
+public:
+  typedef G graph_type;
+  typedef typename G::value_type value_type;
+  typedef typename search_types<G>::answer_type answer_type;
+  typedef batch_worker<value_type, batch_kernel_max> worker_type;
+
+  explicit batch_solver(const solve_options &o) :
+    opt(o), workers(), offset(), order(), large(), total_nodes(0) {
+    if (!opt.checkpoint.empty() || !opt.resume.empty() || opt.cluster || opt.time_limit > 0)
+      throw std::runtime_error("Checkpoints, time limits and distributed searches apply to single solves");
+    opt.on_incumbent = nullptr;
+  }
+
+  // The answers for graphs, in the same order. Graphs of up to
+  // batch_kernel_max nodes are spread over the threads, the others are
+  // searched in parallel one after the other. The answers refer to the
+  // graphs, which have to outlive them.
+  std::vector<answer_type> solve(const std::vector<G> &graphs) {
+    const std::size_t count = graphs.size();
+    offset.resize(count + 1);
+    offset[0] = 0;
+    for (std::size_t i=0; i<count; i++) offset[i+1] = offset[i] + graphs[i].size();
+    order.resize(offset[count]);
+    large.clear();
+    for (std::size_t i=0; i<count; i++)
+      if (graphs[i].size() > batch_kernel_max) large.push_back(i);
+    if (workers.size() < static_cast<std::size_t>(omp_get_max_threads()))
+      workers.resize(omp_get_max_threads());
+    total_nodes = 0;
+
+    // Exceptions cannot leave the parallel region; the first one is
+    // thrown after it
+    std::exception_ptr error;
+    std::size_t nodes = 0;
+#pragma omp parallel default(shared) reduction(+:nodes)
+    {
+      std::unique_ptr<worker_type> &w = workers[omp_get_thread_num()];
+#pragma omp for schedule(dynamic)
+      for (std::size_t i=0; i<count; i++) {
+        if (graphs[i].size() > batch_kernel_max) continue;
+        try {
+          // Made by the thread that uses it, so its memory is local to it
+          if (!w) w.reset(new worker_type(opt));
+          w->solve(graphs[i], order.data() + offset[i], nodes);
+        }
+        catch (...) {
+#pragma omp critical (batch_error)
+          if (!error) error = std::current_exception();
+        }
+      }
+    }
+    if (error) std::rethrow_exception(error);
+    total_nodes = nodes;
+
+    for (std::size_t i : large) {
+      solve_stats stats;
+      const answer_type a = ::solve(graphs[i], opt, &stats);
+      std::copy(a.begin(), a.end(), order.begin() + offset[i]);
+      total_nodes += stats.nodes;
+    }
+
+    std::vector<answer_type> answers;
+    answers.reserve(count);
+    for (std::size_t i=0; i<count; i++) {
+      const typename answer_type::container_type o(order.begin() + offset[i], order.begin() + offset[i+1]);
+      answers.push_back(answer_type(graphs[i], o, opt.mode));
+    }
+    return answers;
+  }
+
+  // Search nodes checked in the last batch
+  std::size_t nodes() const { return total_nodes; }
+
+private:
+  solve_options opt;
+  std::vector< std::unique_ptr<worker_type> > workers;
+  // The order of graph i is order[offset[i], offset[i+1])
+  std::vector<std::size_t> offset, order;
+  std::vector<std::size_t> large;
+  std::size_t total_nodes;
+};
+
+
+#endif
@@ -0,0 +1,322 @@
+// Benchmarks for the branch-and-bound search. Every instance is solved
+// for every branch_level and thread count; each configuration is
+// reported as one JSON object per line on standard output. With
+// --batch, batches of small random instances are solved instead, and
+// with --updates, every instance is solved again after small changes.
+#include <omp.h>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "solve_impl.hh"
+#include "batch_impl.hh"
+#include "incremental_impl.hh"
+#include "instance_impl.hh"
+
+struct instance {
+  std::string name;
+  graph_type graph;
+};
+
+struct run_result {
+  double start, elapsed, first_incumbent, optimal;
+  std::size_t nodes, improvements;
+  real weight;
+  counters_vector counters;
+};
+
+// Comma separated list of numbers, and "auto" for branch levels
+std::vector<index_type> parse_list(const std::string &s, bool levels=false) {
+  std::vector<index_type> v;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ','))
+    if (levels && item == "auto") v.push_back(adaptive_level);
+    else if (!item.empty()) v.push_back(std::stoul(item));
+  if (v.empty()) throw std::runtime_error("Empty list: " + s);
+  return v;
+}
+
+// Instance name without directory and extension
+std::string base_name(const std::string &filename) {
+  std::string s = filename.substr(filename.find_last_of('/') + 1);
+  return s.substr(0, s.find_last_of('.'));
+}
+
+run_result run(const graph_type &g, const solve_options &opt) {
+  solve_stats stats;
+  const double start = omp_get_wtime();
+  const answer_type sp = solve(g, opt, &stats);
+  run_result r;
+  r.start = start;
+  r.counters = stats.threads;
+  r.elapsed = omp_get_wtime() - start;
+  r.nodes = stats.nodes;
+  r.weight = sp.weight();
+  // The seed is no incumbent if it is the longest_path() sentinel. The
+  // last answer kept is the optimum.
+  r.first_incumbent = r.optimal = r.elapsed;
+  r.improvements = 0;
+  for (const auto &inc : stats.incumbents) {
+    if (inc.second == std::numeric_limits<real>::max()) continue;
+    if (r.improvements++ == 0) r.first_incumbent = inc.first - start;
+    r.optimal = inc.first - start;
+  }
+  return r;
+}
+
+// count random point sets of n nodes in a 100 x 100 square
+std::vector<graph_type> random_graphs(index_type n, index_type count) {
+  std::mt19937 rng(n);
+  std::uniform_real_distribution<real> coord(0, 100);
+  std::vector<graph_type> graphs;
+  for (index_type k=0; k<count; k++) {
+    coordinate_set<real> points(n);
+    for (index_type i=0; i<n; i++) points.set_point(i, coord(rng), coord(rng));
+    graph_type::table_type dt(n);
+    points.fill(dt);
+    graphs.push_back(graph_type(std::move(dt)));
+  }
+  return graphs;
+}
+
+// Batches of count instances of every size, through a batch_solver and
+// through solve() one at a time, for every thread count
+int run_batches(const std::vector<index_type> &sizes, index_type count,
+                const std::vector<index_type> &threads, index_type repeat,
+                const solve_options &opt, const std::string &mode_name,
+                const std::string &bound_name) {
+  int status = 0;
+  for (index_type n : sizes) {
+    const std::vector<graph_type> graphs = random_graphs(n, count);
+    for (index_type t : threads) {
+      omp_set_num_threads(t);
+      batch_solver<graph_type> solver(opt);
+      std::vector<double> times;
+      std::vector<answer_type> batch;
+      for (index_type k=0; k<repeat; k++) {
+        const double start = omp_get_wtime();
+        batch = solver.solve(graphs);
+        times.push_back(omp_get_wtime() - start);
+      }
+      std::sort(times.begin(), times.end());
+      const double elapsed = times[times.size() / 2];
+
+      bool agrees = true;
+      const double start = omp_get_wtime();
+      for (index_type i=0; i<count; i++) {
+        const real w = solve(graphs[i], opt).weight();
+        if (std::abs(w - batch[i].weight()) > 1e-9 * std::abs(w)) agrees = false;
+      }
+      const double single = omp_get_wtime() - start;
+      if (!agrees) {
+        std::cerr << "batch" << n << ": weights differ from solve()" << std::endl;
+        status = 1;
+      }
+
+      std::cout << "{\"instance\": \"batch" << n << "\""
+                << ", \"size\": " << n
+                << ", \"count\": " << count
+                << ", \"mode\": \"" << mode_name << "\""
+                << ", \"bound\": \"" << bound_name << "\""
+                << ", \"threads\": " << t
+                << ", \"runs\": " << repeat
+                << ", \"agrees\": " << (agrees ? "true" : "false")
+                << ", \"elapsed\": " << elapsed
+                << ", \"elapsed_min\": " << times.front()
+                << ", \"nodes\": " << solver.nodes()
+                << ", \"instances_per_sec\": " << (elapsed > 0 ? count / elapsed : 0)
+                << ", \"elapsed_solve\": " << single
+                << ", \"speedup\": " << (elapsed > 0 ? single / elapsed : 1)
+                << "}" << std::endl;
+    }
+  }
+  return status;
+}
+
+// Median of v
+double median(std::vector<double> v) {
+  std::sort(v.begin(), v.end());
+  return v[v.size() / 2];
+}
+
+// Solve the instance, then change `changes` random distances by up to
+// 10% `updates` times, solving again after each through an
+// incremental_solver and from scratch
+int run_updates(const instance &in, index_type updates, index_type changes,
+                const solve_options &opt, const std::string &mode_name,
+                const std::string &bound_name) {
+  std::mt19937 rng(in.graph.size());
+  std::uniform_int_distribution<std::size_t> node(0, in.graph.size() - 1);
+  std::uniform_real_distribution<real> scale(0.9, 1.1);
+  incremental_solver<graph_type> solver(in.graph, opt);
+  double start = omp_get_wtime();
+  solver.solve();
+  const double first = omp_get_wtime() - start;
+
+  int status = 0;
+  index_type searched = 0;
+  std::size_t nodes = 0;
+  std::vector<double> resolve, cold;
+  for (index_type u=0; u<updates; u++) {
+    std::vector<distance_change<real>> batch;
+    while (batch.size() < changes) {
+      const std::size_t i = node(rng), j = node(rng);
+      if (i != j) batch.push_back(distance_change<real>{i, j, solver.graph().distance(i, j) * scale(rng)});
+    }
+    solve_stats stats;
+    start = omp_get_wtime();
+    const real w = solver.update(batch, &stats).weight();
+    resolve.push_back(omp_get_wtime() - start);
+    if (stats.nodes > 0) searched++;
+    nodes += stats.nodes;
+
+    start = omp_get_wtime();
+    const real expected = solve(solver.graph(), opt).weight();
+    cold.push_back(omp_get_wtime() - start);
+    if (std::abs(w - expected) > 1e-9 * std::abs(expected)) {
+      std::cerr << in.name << ": update " << u << " weighs " << w << ", not " << expected << std::endl;
+      status = 1;
+    }
+  }
+
+  std::cout << "{\"instance\": \"" << in.name << "\""
+            << ", \"size\": " << in.graph.size()
+            << ", \"mode\": \"" << mode_name << "\""
+            << ", \"bound\": \"" << bound_name << "\""
+            << ", \"threads\": " << omp_get_max_threads()
+            << ", \"updates\": " << updates
+            << ", \"changes\": " << changes
+            << ", \"agrees\": " << (status == 0 ? "true" : "false")
+            << ", \"first_solve\": " << first
+            << ", \"elapsed_update\": " << median(resolve)
+            << ", \"elapsed_cold\": " << median(cold)
+            << ", \"searched\": " << searched
+            << ", \"nodes\": " << nodes
+            << ", \"speedup\": " << (median(resolve) > 0 ? median(cold) / median(resolve) : 1)
+            << "}" << std::endl;
+  return status;
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<index_type> threads, levels = {adaptive_level, 1, 2, 3, 4}, sizes = {24, 32, 40};
+  for (int t=1; t<omp_get_max_threads(); t *= 2) threads.push_back(t);
+  threads.push_back(omp_get_max_threads());
+  index_type repeat = 3, batch = 0, updates = 0, changes = 3;
+  bool sizes_given = false;
+  std::string bound_name("hk"), mode_name("fixed"), select_name("lifo");
+  std::vector<std::string> files;
+  solve_options opt;
+  opt.engine = bnb_engine;
+  opt.checkpoint_interval = 0;
+
+  for (int i=1; i<argc; i++) {
+    std::string arg(argv[i]);
+    if (arg.compare(0, 10, "--threads=") == 0) threads = parse_list(arg.substr(10));
+    else if (arg.compare(0, 9, "--levels=") == 0) levels = parse_list(arg.substr(9), true);
+    else if (arg.compare(0, 8, "--sizes=") == 0) {
+      sizes = (arg == "--sizes=none") ? std::vector<index_type>() : parse_list(arg.substr(8));
+      sizes_given = true;
+    }
+    else if (arg.compare(0, 8, "--batch=") == 0) batch = std::stoul(arg.substr(8));
+    else if (arg.compare(0, 10, "--updates=") == 0) updates = std::stoul(arg.substr(10));
+    else if (arg.compare(0, 10, "--changes=") == 0) changes = std::max(1ul, std::stoul(arg.substr(10)));
+    else if (arg.compare(0, 9, "--repeat=") == 0) repeat = std::max(1ul, std::stoul(arg.substr(9)));
+    else if (arg.compare(0, 8, "--bound=") == 0) bound_name = arg.substr(8);
+    else if (arg.compare(0, 7, "--mode=") == 0) mode_name = arg.substr(7);
+    else if (arg.compare(0, 9, "--select=") == 0) select_name = arg.substr(9);
+    else if (arg.compare(0, 11, "--restarts=") == 0) opt.restarts = std::stoul(arg.substr(11));
+    else if (arg == "--kernels=fixed") opt.fixed_kernels = true;
+    else if (arg == "--kernels=generic") opt.fixed_kernels = false;
+    else if (arg.compare(0, 12, "--dominance=") == 0) opt.dominance_memory = std::stoul(arg.substr(12)) << 20;
+    else if (arg.compare(0, 2, "--") == 0) throw std::runtime_error("Unknown option: " + arg);
+    else files.push_back(arg);
+  }
+  if (files.empty())
+    files = {"instances/rand16.tsp", "instances/clust18.tsp",
+             "instances/grid20.tsp", "instances/ring22.tsp", "instances/detour17.tsp"};
+  opt.bound = parse_bound(bound_name);
+  opt.mode = parse_mode(mode_name);
+  opt.select = parse_select(select_name);
+  std::cout << std::setprecision(9);
+  if (batch > 0) {
+    if (!sizes_given) sizes = {8, 10, 12, 14};
+    return run_batches(sizes, batch, threads, repeat, opt, mode_name, bound_name);
+  }
+
+  std::vector<instance> inst;
+  for (index_type n : sizes)
+    inst.push_back(instance{"synthetic" + std::to_string(n), create_point_set<real>(n)});
+  for (const std::string &f : files)
+    inst.push_back(instance{base_name(f), read_tsplib<real>(f)});
+
+  int status = 0;
+  if (updates > 0) {
+    omp_set_num_threads(threads.back());
+    opt.branch_level = levels[0];
+    for (const instance &in : inst)
+      status |= run_updates(in, updates, changes, opt, mode_name, bound_name);
+    return status;
+  }
+  for (const instance &in : inst) {
+    real expected = 0;
+    for (std::size_t l=0; l<levels.size(); l++) {
+      // Speedups are relative to the first thread count
+      double base = 0;
+      for (std::size_t t=0; t<threads.size(); t++) {
+        omp_set_num_threads(threads[t]);
+        opt.branch_level = levels[l];
+        std::vector<run_result> runs;
+        for (index_type k=0; k<repeat; k++) runs.push_back(run(in.graph, opt));
+        std::sort(runs.begin(), runs.end(),
+                  [](const run_result &a, const run_result &b) { return a.elapsed < b.elapsed; });
+        const run_result &r = runs[runs.size() / 2];
+        if (t == 0) base = r.elapsed;
+
+        // Every configuration has to find the same optimum
+        if (l == 0 && t == 0) expected = r.weight;
+        const bool agrees = std::abs(r.weight - expected) <= 1e-9 * std::abs(expected);
+        if (!agrees) {
+          std::cerr << in.name << ": weight " << r.weight << " differs from " << expected << std::endl;
+          status = 1;
+        }
+
+        const std::string level_name = (levels[l] == adaptive_level) ? std::string("\"auto\"")
+                                                                     : std::to_string(levels[l]);
+        std::cout << "{\"instance\": \"" << in.name << "\""
+                  << ", \"size\": " << in.graph.size()
+                  << ", \"mode\": \"" << mode_name << "\""
+                  << ", \"bound\": \"" << bound_name << "\""
+                  << ", \"select\": \"" << select_name << "\""
+                  << ", \"restarts\": " << opt.restarts
+                  << ", \"kernels\": \"" << (opt.fixed_kernels ? "fixed" : "generic") << "\""
+                  << ", \"dominance_mib\": " << (opt.dominance_memory >> 20)
+                  << ", \"branch_level\": " << level_name
+                  << ", \"threads\": " << threads[t]
+                  << ", \"runs\": " << repeat
+                  << ", \"weight\": " << r.weight
+                  << ", \"agrees\": " << (agrees ? "true" : "false")
+                  << ", \"elapsed\": " << r.elapsed
+                  << ", \"elapsed_min\": " << runs.front().elapsed
+                  << ", \"nodes\": " << r.nodes
+                  << ", \"nodes_per_sec\": " << (r.elapsed > 0 ? r.nodes / r.elapsed : 0)
+                  << ", \"time_to_first_incumbent\": " << r.first_incumbent
+                  << ", \"time_to_optimal\": " << r.optimal
+                  << ", \"improvements\": " << r.improvements
+                  << ", \"speedup\": " << (r.elapsed > 0 ? base / r.elapsed : 1);
+        if (search_counters::enabled) {
+          std::cout << ", \"counters\": ";
+          write_counters_json(std::cout, r.counters, r.start);
+        }
+        std::cout << "}" << std::endl;
+      }
+    }
+  }
+  return status;
+}
@@ -0,0 +1,28 @@
+#ifndef BOUND_HH
+#define BOUND_HH
+
+#include <cstddef>
+
+// Lower bound on the weight of any complete path extending a partial
+// search path. Bounds keep scratch space, so every thread needs its own.
+template <typename P>
+class path_bound {
+public:
+  typedef P path_type;
+  typedef typename path_type::value_type value_type;
+  typedef std::size_t size_type;
+  typedef size_type index_type;
+
+  // Return a lower bound for sp. Once the bound is known to exceed
+  // cutoff, an implementation may stop early and return any value
+  // above cutoff.
+  virtual value_type operator()(const path_type &sp, value_type cutoff) = 0;
+
+  // Forget what was learnt about the graph, whose distances changed
+  virtual void reset() { }
+
+  virtual ~path_bound() { }
+};
+
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef BOUND_IMPL_HH
+#define BOUND_IMPL_HH
+
+#include "bound.hh"
+#include "path.hh"
+#include <vector>
+#include <limits>
+#include <algorithm>
+
+// Weight of the partial path alone (no look-ahead)
+template <typename P>
+class weight_bound : public path_bound<P> {
+public:
+  typedef path_bound<P> base_type;
+  typedef typename base_type::path_type path_type;
+  typedef typename base_type::value_type value_type;
+
+  value_type operator()(const path_type &sp, value_type cutoff)
+  { (void)cutoff; return sp.weight(); }
+};
+
+
+// Weight of the partial path plus a minimum spanning tree over the last
+// node and all unvisited nodes (and the first node, which a tour has to
+// return to). Any completion of the path is one such spanning tree, so
+// it can be no shorter.
+template <typename P>
+class mst_bound : public path_bound<P> {
+public:
+  typedef path_bound<P> base_type;
+  typedef typename base_type::path_type path_type;
+  typedef typename base_type::value_type value_type;
+  typedef typename base_type::size_type size_type;
+  typedef typename base_type::index_type index_type;
+  typedef typename path_type::graph_type graph_type;
+  typedef typename path_type::const_iterator const_iterator;
+
+  mst_bound(const graph_type &g) : node(g.size()+1), key(g.size()+1), dist(g.size()+1) { }
+
+  value_type operator()(const path_type &sp, value_type cutoff) {
+    const graph_type &g = sp.graph();
+    value_type w = sp.weight();
+    size_type m = 0;
+    node[m++] = sp.back();
+    for (const_iterator it=sp.remaining_begin(); it != sp.remaining_end(); ++it)
+      node[m++] = *it;
+    if (sp.mode() == closed_tour && m > 1 && sp.size() > 1) node[m++] = *sp.begin();
+
+    // Prim's algorithm; node[0,k) is the tree built so far. Distances
+    // from the node just added come in one batch.
+    g.distances(node[0], node.data()+1, m-1, key.data()+1);
+    for (index_type k=1; k<m; k++) {
+      index_type next = k;
+      for (index_type a=k+1; a<m; a++)
+        if (key[a] < key[next]) next = a;
+      w += key[next];
+      if (w > cutoff) return w;
+      std::swap(node[k], node[next]);
+      std::swap(key[k], key[next]);
+      g.distances(node[k], node.data()+k+1, m-k-1, dist.data()+k+1);
+      for (index_type a=k+1; a<m; a++)
+        key[a] = std::min(key[a], dist[a]);
+    }
+    return w;
+  }
+
+private:
+  std::vector<index_type> node;
+  std::vector<value_type> key, dist;
+};
+
+
+// Held-Karp bound: a minimum spanning tree over the last node, the
+// unvisited nodes and an end node, with node multipliers tightened by
+// subgradient steps. The end node is the first node for tours and a
+// dummy free to join any unvisited node for open paths. A completion of
+// the path is such a tree in which every unvisited node has degree two,
+// so for any multipliers pi
+//   weight + MST(d_ab + pi_a + pi_b) - 2 sum(pi)
+// is a lower bound. Multipliers are kept between calls as a warm start.
+template <typename P>
+class held_karp_bound : public path_bound<P> {
+public:
+  typedef path_bound<P> base_type;
+  typedef typename base_type::path_type path_type;
+  typedef typename base_type::value_type value_type;
+  typedef typename base_type::size_type size_type;
+  typedef typename base_type::index_type index_type;
+  typedef typename path_type::graph_type graph_type;
+  typedef typename path_type::const_iterator const_iterator;
+
+  held_karp_bound(const graph_type &g, size_type iterations=8) :
+    niter(iterations), dummy(g.size()), tail(g.size()), node(g.size()+1), gnode(g.size()+1),
+    parent(g.size()+1), key(g.size()+1), dist(g.size()+1), lpi(g.size()+1), pi(g.size(), value_type()),
+    degree(g.size()+1) { }
+
+  value_type operator()(const path_type &sp, value_type cutoff) {
+    const graph_type &g = sp.graph();
+    const value_type w0 = sp.weight();
+    if (w0 > cutoff) return w0;
+
+    const size_type m = sp.remaining_end() - sp.remaining_begin();
+    if (m == 0) return w0;
+    // A tour still at its first node is bounded as an open path, which
+    // is the tour without its last edge
+    tail = (sp.mode() == closed_tour && sp.size() > 1) ? *sp.begin() : dummy;
+    if (m == 1) {
+      const index_type u = *sp.remaining_begin();
+      return w0 + g.distance(sp.back(), u) + ((tail == dummy) ? value_type() : g.distance(u, tail));
+    }
+
+    // Node 0 is the last node on the path, followed by the unvisited
+    // nodes and the end node
+    node[0] = sp.back();
+    std::copy(sp.remaining_begin(), sp.remaining_end(), node.begin()+1);
+    node[m+1] = tail;
+
+    const bool finite = (cutoff < std::numeric_limits<value_type>::max());
+    value_type best = w0;
+    for (size_type iter=0; iter<niter; iter++) {
+      const value_type w = w0 + spanning_tree(g, m);
+      best = std::max(best, w);
+      // Without an incumbent there is nothing to tighten towards
+      if (best > cutoff || !finite) break;
+
+      value_type norm = value_type();
+      for (index_type a=1; a<=m+1; a++) {
+        if (node[a] == tail) continue;
+        const value_type s = static_cast<value_type>(degree[node[a]]) - 2;
+        norm += s*s;
+      }
+      // Every unvisited node has degree two: the tree is a path and
+      // the bound is exact
+      if (norm == value_type()) break;
+
+      const value_type step = (cutoff - w) / norm;
+      for (index_type a=1; a<=m+1; a++)
+        if (node[a] != tail)
+          pi[node[a]] += step * (static_cast<value_type>(degree[node[a]]) - 2);
+    }
+    return best;
+  }
+
+  void reset() { std::fill(pi.begin(), pi.end(), value_type()); }
+
+private:
+  // Minimum spanning tree under the multiplier-adjusted weights, minus
+  // twice the multipliers. Fills degree[] for the nodes involved.
+  value_type spanning_tree(const graph_type &g, size_type m) {
+    const size_type nn = m + 2;
+    value_type total = value_type();
+    // Prim reorders node[1,nn) but node[0] stays the last path node
+    lpi[0] = value_type();
+    for (index_type a=1; a<nn; a++) {
+      lpi[a] = (node[a] == tail) ? value_type() : pi[node[a]];
+      total -= 2 * lpi[a];
+    }
+    for (index_type a=0; a<nn; a++) degree[node[a]] = 0;
+
+    // Prim's algorithm from the last node; node[0,k) is the tree. The
+    // end node cannot attach directly to the last node.
+    // Distances come in batches over gnode, which is node with the
+    // dummy replaced by a real node; those entries are never used.
+    for (index_type a=0; a<nn; a++) gnode[a] = (node[a] == dummy) ? node[0] : node[a];
+    g.distances(gnode[0], gnode.data()+1, nn-1, key.data()+1);
+    for (index_type a=1; a<nn; a++) {
+      key[a] = (node[a] == tail) ? std::numeric_limits<value_type>::max() : key[a] + lpi[a];
+      parent[a] = node[0];
+    }
+    for (index_type k=1; k<nn; k++) {
+      index_type next = k;
+      for (index_type a=k+1; a<nn; a++)
+        if (key[a] < key[next]) next = a;
+      std::swap(node[k], node[next]);
+      std::swap(gnode[k], gnode[next]);
+      std::swap(key[k], key[next]);
+      std::swap(lpi[k], lpi[next]);
+      std::swap(parent[k], parent[next]);
+      total += key[k];
+      degree[node[k]]++;
+      degree[parent[k]]++;
+
+      const bool kdummy = (node[k] == dummy);
+      g.distances(gnode[k], gnode.data()+k+1, nn-k-1, dist.data()+k+1);
+      for (index_type a=k+1; a<nn; a++) {
+        const value_type c = (kdummy || node[a] == dummy) ? lpi[k] + lpi[a] :
+          dist[a] + lpi[k] + lpi[a];
+        if (c < key[a]) { key[a] = c; parent[a] = node[k]; }
+      }
+    }
+    return total;
+  }
+
+  size_type niter;
+  index_type dummy, tail;
+  std::vector<index_type> node, gnode, parent;
+  std::vector<value_type> key, dist, lpi, pi;
+  std::vector<size_type> degree;
+};
+
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef CANDIDATE_IMPL_HH
+#define CANDIDATE_IMPL_HH
+
+// Per-node candidate lists: the k nearest other nodes of every node,
+// nearest first. Nodes are ordered by (distance, index), so whether a
+// node made it into a list can be told from the last entry alone.
+#include <omp.h>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+template <typename G>
+class candidate_lists {
+public:
+  typedef G graph_type;
+  typedef typename graph_type::size_type size_type;
+  typedef typename graph_type::index_type index_type;
+  typedef typename graph_type::value_type value_type;
+  typedef const index_type* const_iterator;
+
+  // Lists of length min(k, n-1); k = 0 means all other nodes
+  candidate_lists(const graph_type &g, size_type k=0) :
+    n(g.size()), k(k), len(length(n, k)), list(n*len), last_distance(n), other(), d(), mygraph(g) {
+#pragma omp parallel default(shared)
+    {
+      std::vector<index_type> other;
+      std::vector<value_type> d(n);
+#pragma omp for schedule(dynamic)
+      for (index_type i=0; i<n; i++) build(i, other, d);
+    }
+  }
+
+  // Recompute the lists after the graph changed, on the calling thread.
+  // Storage is only ever grown, so a graph no larger than any before
+  // costs no allocation.
+  void rebuild() {
+    n = mygraph.size();
+    len = length(n, k);
+    list.resize(n*len);
+    last_distance.resize(n);
+    d.resize(n);
+    for (index_type i=0; i<n; i++) build(i, other, d);
+  }
+
+  // Recompute the list of node i after its distances changed
+  void rebuild(index_type i) {
+    d.resize(n);
+    build(i, other, d);
+  }
+
+  // Length of every list
+  size_type size() const { return len; }
+
+  const_iterator begin(index_type i) const { return list.data() + i*len; }
+  const_iterator end(index_type i) const { return list.data() + (i+1)*len; }
+
+  // True if j is on the list of i
+  bool contains(index_type i, index_type j) const {
+    if (len == 0 || j == i) return false;
+    const index_type last = list[(i+1)*len - 1];
+    const value_type d = mygraph.distance(i, j);
+    return d < last_distance[i] || (d == last_distance[i] && j <= last);
+  }
+
+private:
+  static size_type length(size_type n, size_type k)
+  { return (k == 0 || k+1 > n) ? (n ? n-1 : 0) : k; }
+
+  // One batch of distances per node, sorted by (distance, index)
+  void build(index_type i, std::vector<index_type> &other, std::vector<value_type> &d) {
+    mygraph.range_distances(i, 0, n, d.data());
+    other.clear();
+    for (index_type j=0; j<n; j++) if (j != i) other.push_back(j);
+    std::partial_sort(other.begin(), other.begin()+len, other.end(),
+                      [&](index_type a, index_type b) { return d[a] < d[b] || (d[a] == d[b] && a < b); });
+    std::copy(other.begin(), other.begin()+len, list.begin()+i*len);
+    if (len > 0) last_distance[i] = d[other[len-1]];
+  }
+
+  size_type n, k, len;
+  std::vector<index_type> list;
+  std::vector<value_type> last_distance;
+  // Scratch for rebuild()
+  std::vector<index_type> other;
+  std::vector<value_type> d;
+  const graph_type &mygraph;
+};
+
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef CHECKPOINT_IMPL_HH
+#define CHECKPOINT_IMPL_HH
+
+// Search checkpoints: the tasks left, the best answer and the progress
+// of a branch-and-bound search, so that a later run can pick it up. A
+// file is a 64-byte header, the answer and the tasks, in host byte order:
+//
+//   offset  0  char[8]   magic "H4CHKPNT"
+//           8  uint32    version (1)
+//          12  uint32    path mode
+//          16  uint64    number of nodes n
+//          24  uint64    checksum of the distances
+//          32  uint32    candidate list length (0: all nodes)
+//          36  uint32    children nearest first (0 or 1)
+//          40  uint64    search nodes checked so far
+//          48  float64   seconds searched so far
+//          56  uint64    number of tasks
+//          64  float64   answer weight
+//          72  uint32    answer length (n, or 0 if none was found)
+//          76  uint32[]  answer nodes
+//              tasks     float64 weight, float64 bound, uint32 first child,
+//                        uint32 length, uint32[length] prefix nodes
+//
+// The tasks are search records: resuming needs the same graph and the
+// same child order, which the header pins down.
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <fstream>
+#include <stdexcept>
+
+struct checkpoint_header {
+  char magic[8];
+  std::uint32_t version, mode;
+  std::uint64_t n, checksum;
+  std::uint32_t candidates, nearest_first;
+  std::uint64_t nodes;
+  double seconds;
+  std::uint64_t ntask;
+};
+
+static_assert(sizeof(checkpoint_header) == 64, "checkpoint_header must take 64 bytes");
+
+// A task of the checkpoint; its prefix is nodes[offset, offset+length)
+struct checkpoint_task {
+  double weight, bound;
+  std::uint32_t first_child, length;
+  std::size_t offset;
+};
+
+struct search_checkpoint {
+  search_checkpoint() : header(), weight(0), answer(), task(), nodes() { }
+
+  checkpoint_header header;
+  double weight;
+  std::vector<std::uint32_t> answer;
+  std::vector<checkpoint_task> task;
+  std::vector<std::uint32_t> nodes;
+
+  // Add a task with the prefix [first, last)
+  template <typename InputIt>
+  void add_task(InputIt first, InputIt last, double w, double b, std::uint32_t c) {
+    const std::size_t offset = nodes.size();
+    nodes.insert(nodes.end(), first, last);
+    task.push_back(checkpoint_task{w, b, c, static_cast<std::uint32_t>(nodes.size() - offset), offset});
+  }
+};
+
+// FNV-1a over the distances of g, row by row
+template <typename G>
+std::uint64_t graph_checksum(const G &g) {
+  std::uint64_t h = 0xcbf29ce484222325ull;
+  std::vector<typename G::value_type> row(g.size());
+  for (std::size_t i=0; i<g.size(); i++) {
+    g.range_distances(i, 0, g.size(), row.data());
+    const unsigned char *b = reinterpret_cast<const unsigned char*>(row.data());
+    for (std::size_t k=0; k<row.size() * sizeof(row[0]); k++) { h ^= b[k]; h *= 0x100000001b3ull; }
+  }
+  return h;
+}
+
+// The file format on any stream (distributed searches send tasks in it)
+inline void write_checkpoint(std::ostream &out, const search_checkpoint &c) {
+  checkpoint_header h = c.header;
+  std::memcpy(h.magic, "H4CHKPNT", 8);
+  h.version = 1;
+  h.ntask = c.task.size();
+  const std::uint32_t alen = c.answer.size();
+  out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+  out.write(reinterpret_cast<const char*>(&c.weight), sizeof(c.weight));
+  out.write(reinterpret_cast<const char*>(&alen), sizeof(alen));
+  out.write(reinterpret_cast<const char*>(c.answer.data()), alen * sizeof(std::uint32_t));
+  for (const checkpoint_task &t : c.task) {
+    out.write(reinterpret_cast<const char*>(&t.weight), sizeof(t.weight));
+    out.write(reinterpret_cast<const char*>(&t.bound), sizeof(t.bound));
+    out.write(reinterpret_cast<const char*>(&t.first_child), sizeof(t.first_child));
+    out.write(reinterpret_cast<const char*>(&t.length), sizeof(t.length));
+    out.write(reinterpret_cast<const char*>(c.nodes.data() + t.offset), t.length * sizeof(std::uint32_t));
+  }
+}
+
+// Written to filename.tmp first and renamed, so a crash while writing
+// leaves the previous checkpoint intact
+inline void write_checkpoint(const std::string &filename, const search_checkpoint &c) {
+  const std::string tmp = filename + ".tmp";
+  {
+    std::ofstream out(tmp.c_str(), std::ios::binary);
+    if (!out) throw std::runtime_error("Cannot create " + tmp);
+    write_checkpoint(out, c);
+    out.flush();
+    if (!out) throw std::runtime_error("Cannot write " + tmp);
+  }
+  if (std::rename(tmp.c_str(), filename.c_str()) != 0)
+    throw std::runtime_error("Cannot rename " + tmp + " to " + filename);
+}
+
+// filename only names the source in errors. Sizes are checked against
+// n unless it is 0 (messages of a distributed search).
+inline search_checkpoint read_checkpoint(std::istream &in, const std::string &filename) {
+  search_checkpoint c;
+  checkpoint_header &h = c.header;
+  auto read = [&](void *p, std::size_t bytes) {
+    if (!in.read(static_cast<char*>(p), bytes)) throw std::runtime_error(filename + ": truncated checkpoint");
+  };
+  read(&h, sizeof(h));
+  if (std::memcmp(h.magic, "H4CHKPNT", 8) != 0 || h.version != 1)
+    throw std::runtime_error(filename + ": not a checkpoint");
+  std::uint32_t alen;
+  read(&c.weight, sizeof(c.weight));
+  read(&alen, sizeof(alen));
+  if (alen != 0 && h.n != 0 && alen != h.n) throw std::runtime_error(filename + ": bad answer");
+  c.answer.resize(alen);
+  read(c.answer.data(), alen * sizeof(std::uint32_t));
+  for (std::uint64_t k=0; k<h.ntask; k++) {
+    checkpoint_task t;
+    read(&t.weight, sizeof(t.weight));
+    read(&t.bound, sizeof(t.bound));
+    read(&t.first_child, sizeof(t.first_child));
+    read(&t.length, sizeof(t.length));
+    if (t.length == 0 || (h.n != 0 && t.length > h.n)) throw std::runtime_error(filename + ": bad task");
+    t.offset = c.nodes.size();
+    c.nodes.resize(t.offset + t.length);
+    read(c.nodes.data() + t.offset, t.length * sizeof(std::uint32_t));
+    c.task.push_back(t);
+  }
+  return c;
+}
+
+inline search_checkpoint read_checkpoint(const std::string &filename) {
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  if (!in) throw std::runtime_error("Cannot open " + filename);
+  return read_checkpoint(in, filename);
+}
+
+
+#endif
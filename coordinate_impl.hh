@@ -0,0 +1,153 @@
+#ifndef COORDINATE_IMPL_HH
+#define COORDINATE_IMPL_HH
+
+// Points in the plane as an implicit complete graph: only the
+// coordinates are stored (O(n) memory) and distances are computed on
+// demand. The kernels are branch free so that the batched calls, and
+// the dense matrix builder on top of them, vectorize.
+#include "square_symmetric_matrix.hh"
+#include "graph.hh"
+#include <omp.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+// Cube root of s >= 0: a float estimate refined by three Halley steps,
+// within a few ulps of std::cbrt. Unlike std::cbrt it vectorizes.
+inline double cube_root(double s) {
+  float f = static_cast<float>(s);
+  std::uint32_t b;
+  std::memcpy(&b, &f, sizeof(b));
+  b = b / 3 + 0x2a5137a0u; // divide the exponent by three
+  std::memcpy(&f, &b, sizeof(f));
+  double y = f, y3;
+  y3 = y*y*y; y = y * (y3 + 2*s) / (2*y3 + s);
+  y3 = y*y*y; y = y * (y3 + 2*s) / (2*y3 + s);
+  y3 = y*y*y; y = y * (y3 + 2*s) / (2*y3 + s);
+  return (s > 0) * y;
+}
+
+// Metrics, as a combine() of the coordinate differences and a finish()
+// of the result. Both are symmetric in the sign of the differences.
+struct L1_metric {
+  template <typename T> static T combine(T dx, T dy) { return std::abs(dx) + std::abs(dy); }
+  template <typename T> static T finish(T s) { return s; }
+};
+
+struct L2_metric {
+  template <typename T> static T combine(T dx, T dy) { return dx*dx + dy*dy; }
+  template <typename T> static T finish(T s) { return std::sqrt(s); }
+};
+
+struct Linf_metric {
+  template <typename T> static T combine(T dx, T dy) {
+    const T ax = std::abs(dx), ay = std::abs(dy);
+    return (ax > ay) ? ax : ay;
+  }
+  template <typename T> static T finish(T s) { return s; }
+};
+
+// ( |dx|^(3/2) + |dy|^(3/2) )^(2/3)
+struct Minkowski15_metric {
+  template <typename T> static T combine(T dx, T dy) {
+    const T ax = std::abs(dx), ay = std::abs(dy);
+    return ax*std::sqrt(ax) + ay*std::sqrt(ay);
+  }
+  template <typename T> static T finish(T s) {
+    const double c = cube_root(s);
+    return static_cast<T>(c*c);
+  }
+};
+
+
+template < typename T=double, typename M=Minkowski15_metric >
+class coordinate_set : public basic_graph<coordinate_set<T,M>, T> {
+public:
+  typedef basic_graph<coordinate_set<T,M>, T> base_type;
+  typedef M metric_type;
+  typedef typename base_type::size_type size_type;
+  typedef typename base_type::index_type index_type;
+  typedef typename base_type::value_type value_type;
+  typedef std::vector< T, aligned_allocator<T> > container_type;
+
+  // n points at the origin
+  coordinate_set(size_type n) : px(n), py(n) { }
+
+  void set_point(index_type i, value_type x, value_type y) { px[i] = x; py[i] = y; }
+  value_type x(index_type i) const { return px[i]; }
+  value_type y(index_type i) const { return py[i]; }
+
+  size_type size() const
+  { return px.size(); }
+
+  size_type num_neighbor(index_type gi) const
+  { (void)gi; return size() - 1; }
+
+  size_type neighbor(index_type gi, index_type j) const
+  { return (j < gi) ? j : j + 1; }
+
+  value_type weight(index_type gi, index_type j) const
+  { return distance(gi, neighbor(gi, j)); }
+
+  value_type node_weight(index_type gi) const
+  { (void)gi; return value_type(); }
+
+  // Returns the distance between global nodes i and j
+  value_type distance(index_type i, index_type j) const
+  { return M::finish(M::combine(px[j] - px[i], py[j] - py[i])); }
+
+  // out[a] = distance(i, nodes[a]) for a < m
+  void distances(index_type i, const index_type *nodes, size_type m, value_type *out) const {
+    const value_type xi = px[i], yi = py[i];
+    const value_type *x = px.data(), *y = py.data();
+#pragma omp simd
+    for (size_type a=0; a<m; a++)
+      out[a] = M::finish(M::combine(x[nodes[a]] - xi, y[nodes[a]] - yi));
+  }
+
+  // out[j-first] = distance(i, j) for first <= j < last
+  void range_distances(index_type i, index_type first, index_type last, value_type *out) const {
+    const value_type xi = px[i], yi = py[i];
+    const value_type *x = px.data() + first, *y = py.data() + first;
+#pragma omp simd
+    for (size_type a=0; a<last-first; a++)
+      out[a] = M::finish(M::combine(x[a] - xi, y[a] - yi));
+  }
+
+  // Fill a dense matrix of any layout. Every row computes its part of
+  // the upper triangle in one batch; the lower triangle is then copied
+  // over in tiles (unless the layout shares the entries).
+  template <typename C, typename L>
+  void fill(square_symmetric_matrix<T,C,L> &mat) const {
+    const size_type n = size();
+#pragma omp parallel default(shared)
+    {
+      std::vector<value_type> row(n);
+#pragma omp for schedule(dynamic, 16)
+      for (size_type i=0; i<n; i++) {
+        range_distances(i, i+1, n, row.data());
+        mat(i,i) = value_type();
+        for (size_type j=i+1; j<n; j++) mat(i,j) = row[j-i-1];
+      }
+      if (!std::is_same<L, packed_layout>::value) {
+        enum { tile = 64 };
+#pragma omp for schedule(dynamic)
+        for (size_type ti=0; ti<n; ti+=tile)
+          for (size_type tj=0; tj<=ti; tj+=tile)
+            for (size_type i=ti; i<std::min<size_type>(ti+tile, n); i++)
+              for (size_type j=tj; j<std::min<size_type>(tj+tile, i); j++)
+                mat(i,j) = mat(j,i);
+      }
+    }
+  }
+
+private:
+  container_type px, py;
+};
+
+
+#endif
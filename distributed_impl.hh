@@ -0,0 +1,478 @@
+#ifndef DISTRIBUTED_IMPL_HH
+#define DISTRIBUTED_IMPL_HH
+
+// Distributed search over several processes. Every process runs the
+// shared-memory search on batches of tasks; a scheduler thread in the
+// first process (the coordinator) hands the batches out, moves work from
+// busy processes to idle ones and passes better answers on to everybody.
+// Processes talk over stream sockets: socket pairs to processes forked
+// on the same host, TCP to workers on other hosts. Every message is a
+// search_checkpoint (checkpoint_impl.hh) of one of these kinds:
+//
+//   hello      worker -> coordinator  header of the graph and options
+//   work       worker -> coordinator  tasks for the pool
+//   request    worker -> coordinator  out of tasks; header.nodes holds
+//                                     the nodes checked since the last
+//   tasks      coordinator -> worker  a batch of tasks and the answer
+//   steal      coordinator -> worker  give some queued tasks back
+//   incumbent  both ways              a better answer
+//   stop       coordinator -> worker  the answer and all nodes checked
+//
+// A worker only requests tasks once it has none left, and the messages
+// on a socket arrive in order, so the search is over exactly when the
+// pool is empty and every worker is waiting for tasks.
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+
+#include "checkpoint_impl.hh"
+
+enum message_kind : std::uint32_t {
+  hello_message = 1, work_message, request_message, tasks_message, steal_message,
+  incumbent_message, stop_message
+};
+
+// Longest message accepted from a peer that said hello, and the size of
+// a hello (a bare header). Anything else is refused before its payload
+// is allocated.
+constexpr std::uint64_t message_limit = std::uint64_t(1) << 30;
+constexpr std::uint64_t hello_size = sizeof(checkpoint_header) + sizeof(double) + sizeof(std::uint32_t);
+
+// One end of a connected stream socket, closed with the channel. Only
+// one thread at a time may use it.
+class message_channel {
+public:
+  explicit message_channel(int f) : fd(f) { }
+  ~message_channel() { close(fd); }
+
+  int handle() const { return fd; }
+
+  // True if a message (or the end of the stream) arrives within
+  // timeout_ms milliseconds (-1: wait for it)
+  bool ready(int timeout_ms) const {
+    pollfd p = {fd, POLLIN, 0};
+    return poll(&p, 1, timeout_ms) > 0;
+  }
+
+  void send(message_kind kind, const search_checkpoint &c) {
+    std::ostringstream out;
+    write_checkpoint(out, c);
+    const std::string payload = out.str();
+    const std::uint64_t head[2] = {kind, payload.size()};
+    write_all(head, sizeof(head));
+    write_all(payload.data(), payload.size());
+  }
+
+  // False at the end of the stream. Messages of unknown kinds or longer
+  // than limit bytes throw, leaving the channel unusable.
+  bool receive(message_kind &kind, search_checkpoint &c, std::uint64_t limit=message_limit) {
+    std::uint64_t head[2];
+    if (!read_all(head, sizeof(head), true)) return false;
+    if (head[0] < hello_message || head[0] > stop_message) throw std::runtime_error("Unknown message");
+    if (head[1] > limit) throw std::runtime_error("Message too long");
+    std::string payload(head[1], '\0');
+    read_all(&payload[0], payload.size(), false);
+    kind = static_cast<message_kind>(head[0]);
+    std::istringstream in(payload);
+    c = read_checkpoint(in, "message");
+    return true;
+  }
+
+private:
+  message_channel(const message_channel &) = delete;
+  message_channel& operator=(const message_channel &) = delete;
+
+  void write_all(const void *data, std::size_t n) {
+    const char *b = static_cast<const char*>(data);
+    while (n > 0) {
+      const ssize_t k = ::send(fd, b, n, MSG_NOSIGNAL);
+      if (k < 0 && errno == EINTR) continue;
+      if (k < 0) throw std::runtime_error("Lost connection: " + std::string(std::strerror(errno)));
+      b += k;
+      n -= k;
+    }
+  }
+
+  // False if the stream ended before the first byte and eof_ok
+  bool read_all(void *data, std::size_t n, bool eof_ok) {
+    char *b = static_cast<char*>(data);
+    const std::size_t total = n;
+    while (n > 0) {
+      const ssize_t k = ::recv(fd, b, n, 0);
+      if (k < 0 && errno == EINTR) continue;
+      if (k == 0 && n == total && eof_ok) return false;
+      if (k <= 0) throw std::runtime_error("Lost connection");
+      b += k;
+      n -= k;
+    }
+    return true;
+  }
+
+  int fd;
+};
+
+// Hands out tasks, in the coordinator; see above. Peer 0 is the
+// coordinator's own search.
+class search_scheduler {
+public:
+  typedef std::size_t size_type;
+
+  search_scheduler(const checkpoint_header &k, std::vector<int> fds, int listen) :
+    key(k), peer(), listen_fd(listen), pool(), best(), nodes(0), over(false) {
+    for (int fd : fds) add_peer(fd);
+  }
+
+  // Until every worker was told to stop
+  void run() {
+    while (!over || waiting()) {
+      std::vector<pollfd> p;
+      for (const std::unique_ptr<peer_state> &q : peer)
+        p.push_back(pollfd{q->channel ? q->channel->handle() : -1, POLLIN, 0});
+      if (listen_fd >= 0 && !over) p.push_back(pollfd{listen_fd, POLLIN, 0});
+      if (poll(p.data(), p.size(), -1) < 0) {
+        if (errno == EINTR) continue;
+        throw std::runtime_error("poll failed: " + std::string(std::strerror(errno)));
+      }
+      for (size_type i=0; i<peer.size(); i++)
+        if (p[i].revents) receive(i);
+      if (listen_fd >= 0 && !over && p.back().revents) {
+        const int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd >= 0) {
+          const int one = 1;
+          setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+          add_peer(fd);
+        }
+      }
+      if (!over) serve();
+    }
+  }
+
+private:
+  // A peer is connected until it is dropped, active once it said hello
+  // and idle while it waits for tasks
+  struct peer_state {
+    std::unique_ptr<message_channel> channel;
+    bool active, idle, stealing;
+  };
+
+  void add_peer(int fd) {
+    peer.emplace_back(new peer_state{std::unique_ptr<message_channel>(new message_channel(fd)),
+                                     false, false, false});
+  }
+
+  // Some connected peer has not been told to stop yet
+  bool waiting() const {
+    for (const std::unique_ptr<peer_state> &q : peer)
+      if (q->channel) return true;
+    return false;
+  }
+
+  void drop(size_type i) { peer[i]->channel.reset(); }
+
+  // A message from peer i. Malformed messages end the connection like
+  // the end of the stream does; until its hello, a peer can send nothing
+  // else.
+  void receive(size_type i) {
+    peer_state &q = *peer[i];
+    message_kind kind;
+    search_checkpoint c;
+    bool received = false;
+    try {
+      received = q.channel->receive(kind, c, q.active ? message_limit : hello_size)
+        && well_formed(kind, c);
+    }
+    catch (const std::exception &) { }
+    if (!received) {
+      // Only a busy worker takes tasks with it
+      if (q.active && !q.idle && !over)
+        throw std::runtime_error("Lost a worker during the search");
+      drop(i);
+      return;
+    }
+    if (!q.active && kind != hello_message) return;
+    switch (kind) {
+    case hello_message:
+      if (c.header.n != key.n || c.header.checksum != key.checksum || c.header.mode != key.mode
+          || c.header.nearest_first != key.nearest_first || c.header.candidates != key.candidates) {
+        drop(i);
+        break;
+      }
+      if (over) { stop(i); break; }
+      q.active = true;
+      break;
+    case work_message:
+      for (const checkpoint_task &t : c.task) {
+        pool.emplace_back();
+        pool.back().add_task(c.nodes.begin() + t.offset, c.nodes.begin() + t.offset + t.length,
+                             t.weight, t.bound, t.first_child);
+      }
+      break;
+    case request_message:
+      nodes += c.header.nodes;
+      q.idle = true;
+      q.stealing = false;
+      break;
+    case incumbent_message:
+      if (best.answer.empty() || c.weight < best.weight) {
+        best.weight = c.weight;
+        best.answer = c.answer;
+        for (size_type j=0; j<peer.size(); j++)
+          if (j != i && peer[j]->channel && peer[j]->active) send(j, incumbent_message, best);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  // Messages a worker sends, with nodes of the graph only
+  bool well_formed(message_kind kind, const search_checkpoint &c) const {
+    auto nodes_ok = [this](const std::vector<std::uint32_t> &v) {
+      for (const std::uint32_t a : v) if (a >= key.n) return false;
+      return true;
+    };
+    switch (kind) {
+    case hello_message:
+    case request_message:
+      return true;
+    case work_message:
+      for (const checkpoint_task &t : c.task) if (t.length > key.n) return false;
+      return nodes_ok(c.nodes);
+    case incumbent_message:
+      return c.answer.size() == key.n && nodes_ok(c.answer);
+    default:
+      return false;
+    }
+  }
+
+  // Batches for the idle workers while there are tasks, steals from the
+  // busy ones otherwise, and the end of the search
+  void serve() {
+    // The coordinator's own search brings the root tasks
+    if (!peer[0]->active) return;
+    size_type active = 0, idle = 0;
+    for (const std::unique_ptr<peer_state> &q : peer)
+      if (q->channel && q->active) { active++; idle += q->idle; }
+    if (idle == 0) return;
+    for (size_type i=0; i<peer.size() && !pool.empty(); i++) {
+      peer_state &q = *peer[i];
+      if (!q.channel || !q.active || !q.idle) continue;
+      // An even share of the pool; tasks the answer beats are dropped
+      const size_type share = (pool.size() + active - 1) / active;
+      search_checkpoint batch;
+      batch.weight = best.weight;
+      batch.answer = best.answer;
+      while (batch.task.size() < share && !pool.empty()) {
+        const search_checkpoint &t = pool.front();
+        if (best.answer.empty() || t.task[0].bound <= best.weight)
+          batch.add_task(t.nodes.begin(), t.nodes.end(), t.task[0].weight, t.task[0].bound,
+                         t.task[0].first_child);
+        pool.pop_front();
+      }
+      if (batch.task.empty()) continue;
+      send(i, tasks_message, batch);
+      q.idle = false;
+      idle--;
+    }
+    if (idle == 0) return;
+    if (idle == active && pool.empty()) {
+      over = true;
+      for (size_type i=0; i<peer.size(); i++)
+        if (peer[i]->channel && peer[i]->active) stop(i);
+      return;
+    }
+    const search_checkpoint none;
+    for (size_type i=0; i<peer.size(); i++) {
+      peer_state &q = *peer[i];
+      if (!q.channel || !q.active || q.idle || q.stealing) continue;
+      send(i, steal_message, none);
+      q.stealing = true;
+    }
+  }
+
+  void stop(size_type i) {
+    search_checkpoint c = best;
+    c.header.nodes = nodes;
+    send(i, stop_message, c);
+    drop(i);
+  }
+
+  void send(size_type i, message_kind kind, const search_checkpoint &c) {
+    peer[i]->channel->send(kind, c);
+  }
+
+  const checkpoint_header key;
+  std::vector< std::unique_ptr<peer_state> > peer;
+  int listen_fd;
+  // One task per entry, oldest first
+  std::deque<search_checkpoint> pool;
+  search_checkpoint best;
+  std::size_t nodes;
+  bool over;
+};
+
+// This process's part in a distributed search: its channel to the
+// scheduler, and in the coordinator the scheduler itself
+class search_cluster {
+public:
+  typedef std::size_t size_type;
+
+  // The coordinator, which forks processes-1 local workers; with a
+  // listen_port, workers on other hosts can connect to it as well. The
+  // workers return from here too, with coordinator() false.
+  explicit search_cluster(size_type processes, int listen_port=0) :
+    is_coordinator(true), link(), worker_fd(), child(), listen_fd(-1), scheduler(), error() {
+    if (listen_port > 0) listen_fd = listen_on(listen_port);
+    for (size_type i=1; i<processes; i++) {
+      int sv[2];
+      if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+        throw std::runtime_error("socketpair failed: " + std::string(std::strerror(errno)));
+      const pid_t pid = fork();
+      if (pid < 0) throw std::runtime_error("fork failed: " + std::string(std::strerror(errno)));
+      if (pid == 0) {
+        close(sv[0]);
+        for (int fd : worker_fd) close(fd);
+        if (listen_fd >= 0) close(listen_fd);
+        worker_fd.clear();
+        child.clear();
+        listen_fd = -1;
+        is_coordinator = false;
+        link.reset(new message_channel(sv[1]));
+        return;
+      }
+      close(sv[1]);
+      worker_fd.push_back(sv[0]);
+      child.push_back(pid);
+    }
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+      throw std::runtime_error("socketpair failed: " + std::string(std::strerror(errno)));
+    worker_fd.insert(worker_fd.begin(), sv[0]);
+    link.reset(new message_channel(sv[1]));
+  }
+
+  // A worker, connected to the coordinator at host:port
+  search_cluster(const std::string &host, int port) :
+    is_coordinator(false), link(), worker_fd(), child(), listen_fd(-1), scheduler(), error() {
+    link.reset(new message_channel(connect_to(host, port)));
+  }
+
+  ~search_cluster() {
+    if (scheduler.joinable()) scheduler.join();
+    for (int fd : worker_fd) close(fd);
+    if (listen_fd >= 0) close(listen_fd);
+    for (pid_t pid : child) waitpid(pid, nullptr, 0);
+  }
+
+  bool coordinator() const { return is_coordinator; }
+
+  // To the scheduler
+  message_channel& channel() { return *link; }
+
+  // Start scheduling the search described by key (coordinator only)
+  void start(const checkpoint_header &key) {
+    std::vector<int> fds;
+    fds.swap(worker_fd);
+    const int listen = listen_fd;
+    listen_fd = -1;
+    scheduler = std::thread([this, key, fds, listen] {
+      try {
+        search_scheduler s(key, fds, listen);
+        s.run();
+      }
+      catch (...) { error = std::current_exception(); }
+      if (listen >= 0) close(listen);
+    });
+  }
+
+  // Wait for the scheduler to finish (coordinator only); rethrows its
+  // error
+  void finish() {
+    if (scheduler.joinable()) scheduler.join();
+    if (error) std::rethrow_exception(error);
+  }
+
+private:
+  enum { connect_retry_ms = 30000 };
+
+  search_cluster(const search_cluster &) = delete;
+  search_cluster& operator=(const search_cluster &) = delete;
+
+  static int listen_on(int port) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error("socket failed: " + std::string(std::strerror(errno)));
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in a;
+    std::memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_ANY);
+    a.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&a), sizeof(a)) != 0 || ::listen(fd, 64) != 0) {
+      close(fd);
+      throw std::runtime_error("Cannot listen on port " + std::to_string(port));
+    }
+    return fd;
+  }
+
+  // Workers may start before the coordinator listens: refused
+  // connections are retried for connect_retry_ms
+  static int connect_to(const std::string &host, int port) {
+    for (int waited=0; ; waited += 100) {
+      try { return try_connect(host, port); }
+      catch (const std::runtime_error &) { if (waited >= connect_retry_ms) throw; }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  }
+
+  static int try_connect(const std::string &host, int port) {
+    addrinfo hints, *res = nullptr;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0)
+      throw std::runtime_error("Unknown host " + host);
+    int fd = -1, err = 0;
+    for (addrinfo *r=res; r && fd < 0; r=r->ai_next) {
+      fd = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+      if (fd >= 0 && connect(fd, r->ai_addr, r->ai_addrlen) != 0) { err = errno; close(fd); fd = -1; }
+    }
+    freeaddrinfo(res);
+    if (fd < 0)
+      throw std::runtime_error("Cannot connect to " + host + ":" + std::to_string(port) + ": "
+                               + std::strerror(err));
+    // Incumbents are small and should go out at once
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+  }
+
+  bool is_coordinator;
+  std::unique_ptr<message_channel> link;
+  std::vector<int> worker_fd;
+  std::vector<pid_t> child;
+  int listen_fd;
+  std::thread scheduler;
+  std::exception_ptr error;
+};
+
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef DOMINANCE_IMPL_HH
+#define DOMINANCE_IMPL_HH
+
+// Dominance table shared by all threads. Prefixes with the same open
+// nodes, the same last node and the same anchor (the node mirrored()
+// compares against) have the same completions searched, so of those
+// only the lightest can lead to a better answer. The table keeps the
+// lightest weight seen for as many such states as fit in its memory.
+//
+// Entries sit in sets of `ways`; a new state replaces the deepest entry
+// of its set, so the shallow states, which prune the largest subtrees,
+// stay. Each entry has a sequence number that is odd while it is being
+// written: readers treat an entry that changed under them as a miss, and
+// writers skip an entry another thread is writing. Either way only some
+// pruning is lost, so the table takes no locks.
+//
+// Entries also carry the generation of the table they were written in;
+// clear() starts a new one, which makes the table empty without
+// touching it (only every 128th clear() wipes it).
+#include <stdlib.h>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <atomic>
+
+template <typename T>
+class dominance_table {
+public:
+  typedef T value_type;
+  typedef std::size_t size_type;
+  typedef std::uint64_t mask_type;
+
+  enum { ways = 4 };
+
+  // About bytes of memory, and at least one set. The entries start out
+  // zero (empty) from calloc, whose pages are only mapped once touched,
+  // so a table much larger than the search needs costs little.
+  explicit dominance_table(size_type bytes) :
+    nset(set_count(bytes)), generation(0),
+    entry(static_cast<slot*>(calloc(nset * ways, sizeof(slot)))) {
+    if (!entry) throw std::bad_alloc();
+  }
+
+  ~dominance_table() { free(entry); }
+
+  // Number of entries
+  size_type size() const { return nset * ways; }
+
+  // Forget every state, between searches
+  void clear() {
+    generation = (generation + 1) & generation_mask;
+    if (generation == 0) std::memset(static_cast<void*>(entry), 0, size() * sizeof(slot));
+  }
+
+  // True if a prefix in the state (open nodes, last node, anchor) was
+  // seen with a weight no greater than w; otherwise w is recorded for the
+  // state. depth is the number of nodes on the prefix.
+  bool dominated(mask_type open, unsigned last, unsigned anchor, unsigned depth, value_type w) {
+    const std::uint32_t key = valid | generation << 24 | (last & 0xff) << 16 | (anchor & 0xff) << 8;
+    slot *set = &entry[(hash(open, key) & (nset - 1)) * ways];
+    slot *victim = nullptr;
+    unsigned victim_depth = 0;
+    for (size_type i=0; i<ways; i++) {
+      slot &e = set[i];
+      const std::uint32_t s1 = e.seq.load(std::memory_order_acquire);
+      const std::uint32_t meta = e.meta.load(std::memory_order_relaxed);
+      const mask_type eopen = e.open.load(std::memory_order_relaxed);
+      const value_type ew = e.weight.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if ((s1 & 1) || e.seq.load(std::memory_order_relaxed) != s1) continue;
+      if ((meta & ~depth_mask) == key && eopen == open) {
+        if (ew <= w) return true;
+        store(e, s1, open, key, depth, w);
+        return false;
+      }
+      // Empty entries (or older generations) first, then the deepest
+      const bool live = (meta & valid) && (meta >> 24 & generation_mask) == generation;
+      const unsigned d = live ? (meta & depth_mask) : depth_mask + 1;
+      if (!victim || d > victim_depth) { victim = &e; victim_depth = d; }
+    }
+    if (victim) {
+      const std::uint32_t s = victim->seq.load(std::memory_order_relaxed);
+      if (!(s & 1)) store(*victim, s, open, key, depth, w);
+    }
+    return false;
+  }
+
+private:
+  dominance_table(const dominance_table &) = delete;
+  dominance_table& operator=(const dominance_table &) = delete;
+
+  // Metadata: valid bit, generation (7 bits), last node, anchor and
+  // depth (8 bits each)
+  enum : std::uint32_t { valid = 0x80000000u, generation_mask = 0x7fu, depth_mask = 0xffu };
+
+  struct slot {
+    std::atomic<std::uint32_t> seq, meta;
+    std::atomic<mask_type> open;
+    std::atomic<value_type> weight;
+  };
+
+  static size_type set_count(size_type bytes) {
+    size_type s = 1;
+    while (2 * s * ways * sizeof(slot) <= bytes) s *= 2;
+    return s;
+  }
+
+  // splitmix64 finalizer
+  static mask_type hash(mask_type open, std::uint32_t key) {
+    mask_type x = open ^ (mask_type(key) << 32 | key);
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27; x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  }
+
+  // Write entry e if its sequence number is still s (even)
+  static void store(slot &e, std::uint32_t s, mask_type open, std::uint32_t key,
+                    unsigned depth, value_type w) {
+    if (!e.seq.compare_exchange_strong(s, s + 1, std::memory_order_acquire)) return;
+    std::atomic_thread_fence(std::memory_order_release);
+    e.meta.store(key | (depth & depth_mask), std::memory_order_relaxed);
+    e.open.store(open, std::memory_order_relaxed);
+    e.weight.store(w, std::memory_order_relaxed);
+    e.seq.store(s + 2, std::memory_order_release);
+  }
+
+  size_type nset;
+  std::uint32_t generation;
+  slot *entry;
+};
+
+
+#endif
@@ -0,0 +1,394 @@
+#ifndef FIXED_IMPL_HH
+#define FIXED_IMPL_HH
+
+// Kernels for graphs of at most N nodes, N known at compile time (up to
+// 64): the distances sit in one N x N block (8 KB for N = 32 and 32 KB
+// for N = 64 in double, so it stays in L1/L2), and the search path keeps
+// its state in std::arrays with the open nodes as a bitmask, so children
+// are found by bit scans and the mirror check is a mask test.
+#include "square_symmetric_matrix.hh"
+#include "graph.hh"
+#include "Euclidean_impl.hh"
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+// Bitmask with a bit for each of N nodes
+template <std::size_t N>
+struct node_mask {
+  static_assert(N >= 1 && N <= 64, "node_mask holds at most 64 nodes");
+  typedef typename std::conditional<(N <= 32), std::uint32_t, std::uint64_t>::type type;
+};
+
+inline unsigned lowest_bit(std::uint32_t m) { return __builtin_ctz(m); }
+inline unsigned lowest_bit(std::uint64_t m) { return __builtin_ctzll(m); }
+
+
+// Copy of any graph of at most N nodes, with the distances in a dense
+// aligned N x N block (row stride N)
+template <typename T, std::size_t N>
+class fixed_set : public basic_graph<fixed_set<T,N>, T> {
+public:
+  typedef basic_graph<fixed_set<T,N>, T> base_type;
+  typedef typename base_type::size_type size_type;
+  typedef typename base_type::index_type index_type;
+  typedef typename base_type::value_type value_type;
+  typedef std::vector< T, aligned_allocator<T> > container_type;
+
+  enum { capacity = N };
+
+  template <typename G>
+  explicit fixed_set(const G &g) : n(0), table(N*N, value_type()) { load(g); }
+
+  // N nodes at distance zero, to load() graphs into later
+  fixed_set() : n(N), table(N*N, value_type()) { }
+
+  // Replace the distances with those of g, in the same block
+  template <typename G>
+  void load(const G &g) {
+    if (g.size() > N) throw std::runtime_error("Graph too large for fixed_set");
+    n = g.size();
+    for (index_type i=0; i<n; i++) g.range_distances(i, 0, n, table.data() + i*N);
+  }
+
+  size_type size() const
+  { return n; }
+
+  size_type num_neighbor(index_type gi) const
+  { (void)gi; return size() - 1; }
+
+  size_type neighbor(index_type gi, index_type j) const
+  { return (j < gi) ? j : j + 1; }
+
+  value_type weight(index_type gi, index_type j) const
+  { return distance(gi, neighbor(gi, j)); }
+
+  value_type node_weight(index_type gi) const
+  { return distance(gi, gi); }
+
+  // Returns the distance between global nodes i and j
+  value_type distance(index_type i, index_type j) const
+  { return table[i*N + j]; }
+
+  // out[a] = distance(i, nodes[a]) for a < m
+  void distances(index_type i, const index_type *nodes, size_type m, value_type *out) const {
+    const value_type *row = table.data() + i*N;
+    for (size_type a=0; a<m; a++) out[a] = row[nodes[a]];
+  }
+
+  // out[j-first] = distance(i, j) for first <= j < last
+  void range_distances(index_type i, index_type first, index_type last, value_type *out) const
+  { std::copy(table.data() + i*N + first, table.data() + i*N + last, out); }
+
+  // Change the distance between nodes i and j
+  void set_distance(index_type i, index_type j, value_type d)
+  { table[i*N + j] = table[j*N + i] = d; }
+
+private:
+  size_type n;
+  container_type table;
+};
+
+
+// Hamiltonian search path over a fixed_set: the same tree, children
+// order and task interface as the generic EH_search_path, with the open
+// nodes as a bitmask. Children past the candidate list are found with a
+// bit scan of the open nodes that are not on the list.
+template <typename T, std::size_t N>
+class EH_search_path< T, fixed_set<T,N> > :
+    public basic_path< EH_search_path< T, fixed_set<T,N> >, T, std::array<std::size_t,N> >,
+    public basic_tree< EH_search_path< T, fixed_set<T,N> > > {
+public:
+  typedef basic_path< EH_search_path, T, std::array<std::size_t,N> > base_type;
+  typedef fixed_set<T,N> graph_type;
+  typedef typename base_type::size_type size_type;
+  typedef typename base_type::index_type index_type;
+  typedef typename base_type::value_type value_type;
+  typedef typename base_type::container_type container_type;
+  typedef typename base_type::const_iterator const_iterator;
+  typedef typename base_type::const_reverse_iterator const_reverse_iterator;
+  typedef typename node_mask<N>::type mask_type;
+
+  typedef std::ptrdiff_t difference_type;
+  typedef search_record<T> record_type;
+  typedef candidate_lists<graph_type> candidates_type;
+
+  template <typename H> friend
+  EH_search_path<typename H::value_type, H> longest_path(const H &g);
+
+  // The traversal and the virtual adapters call the private primitives
+  friend class basic_tree<EH_search_path>;
+  friend class path_adapter<EH_search_path>;
+  friend class tree_adapter<EH_search_path>;
+
+  // Initialize
+  EH_search_path(const graph_type &g, index_type gi, path_mode m=fixed_start) :
+    EH_search_path(g, m) {
+    std::rotate(p.begin(), p.begin()+gi, p.begin()+gi+1);
+    init_state();
+  }
+
+  // Create empty
+  EH_search_path(const graph_type &g, path_mode m=fixed_start) :
+    rsize(0), tlevel(0), frame(), p(), pos(), open(0), total_distance(value_type()),
+    pmode(m), cand(nullptr), cmask(), mygraph(g) {
+    std::iota(p.begin(), p.begin() + g.size(), 0);
+    init_state();
+  }
+
+  // Complete path visiting the nodes in the given order
+  EH_search_path(const graph_type &g, const std::vector<std::size_t> &order, path_mode m=fixed_start) :
+    rsize(g.size()-1), tlevel(0), frame(), p(), pos(), open(0), total_distance(value_type()),
+    pmode(m), cand(nullptr), cmask(), mygraph(g) {
+    std::copy(order.begin(), order.end(), p.begin());
+    init_state();
+    for (index_type i=1; i<n(); i++) total_distance += mygraph.distance(p[i-1], p[i]);
+    if (pmode == closed_tour) total_distance += mygraph.distance(p[n()-1], p[0]);
+  }
+
+  EH_search_path(const EH_search_path &pa) :
+    rsize(pa.rsize), tlevel(pa.tlevel), frame(pa.frame), p(pa.p), pos(pa.pos), open(pa.open),
+    total_distance(pa.total_distance), pmode(pa.pmode), cand(pa.cand), cmask(pa.cmask),
+    mygraph(pa.mygraph) { }
+
+  size_type size() const { return global_level() + 1; }
+  value_type weight() const { return total_distance; }
+
+  const_iterator begin() const { return p.begin(); }
+  const_reverse_iterator rbegin() const { return const_reverse_iterator(p.begin() + n()); }
+  const_iterator end() const { return p.begin() + global_level() + 1; }
+  const_reverse_iterator rend() const { return p.rend(); }
+
+  size_type level() const { return tlevel; }
+
+  size_type global_level() const { return rsize + tlevel; }
+
+  // Last node on the path
+  index_type back() const { return p[global_level()]; }
+
+  // Nodes not yet on the path (in no particular order)
+  const_iterator remaining_begin() const { return end(); }
+  const_iterator remaining_end() const { return p.begin() + n(); }
+
+  path_mode mode() const { return pmode; }
+
+  // Together with back(), the state that decides which completions are
+  // searched (for the dominance table): the open nodes, and the node
+  // mirrored() compares against (0 for fixed paths)
+  mask_type open_nodes() const { return open; }
+  index_type anchor_node() const { return (pmode == fixed_start) ? 0 : p[anchor()]; }
+
+  // Expand children nearest first along c (which must outlive the
+  // path); without candidate lists children come in index order
+  void use_candidates(const candidates_type *c) {
+    cand = c;
+    cmask.fill(0);
+    if (cand)
+      for (index_type i=0; i<n(); i++)
+        for (typename candidates_type::const_iterator it=cand->begin(i); it != cand->end(i); ++it)
+          cmask[i] |= bit(*it);
+  }
+
+  // See EH_search_path::mirrored(); the open nodes above the anchor are
+  // counted from the mask
+  bool mirrored() const {
+    if (pmode == fixed_start) return false;
+    const size_type gl = global_level();
+    if (gl < anchor()) return false;
+    if (gl + 1 == n()) return p[gl] < p[anchor()];
+    return (open & above(p[anchor()])) == 0;
+  }
+
+  // Split tree: hand the subtree below the current node to rec (sized
+  // for size() nodes) and move on to the next branch
+  void split(record_type &rec) {
+    rec.assign(begin(), end(), total_distance);
+    this->next_branch();
+  }
+
+  // Rebuild as the root of the subtree described by rec
+  void assign(const record_type &rec) {
+    open = all();
+    index_type i = 0;
+    for (typename record_type::const_iterator it=rec.begin(); it != rec.end(); ++it, ++i) {
+      place(*it, i);
+      open &= ~bit(*it);
+    }
+    rsize = rec.size() - 1;
+    tlevel = 0;
+    frame[0] = level_frame();
+    total_distance = rec.weight();
+    if (rec.first_child() > 0) enqueue(rec.first_child());
+  }
+
+  // Work donation, as in EH_search_path
+  size_type donor_level(size_type min_open) const {
+    for (size_type l=1; l<=tlevel; l++) {
+      if (n() - rsize - l < min_open) break; // children of the parent
+      if (has_later_siblings(l)) return l;
+    }
+    return 0;
+  }
+
+  bool has_later_siblings(size_type l) const
+  { return !frame[l].closed && frame[l].child + 1 < n() - rsize - l; }
+
+  void donate(size_type l, record_type &rec) {
+    rec.assign(p.begin(), p.begin() + rsize + l, frame[l-1].weight);
+    rec.set_first_child(frame[l].child + 1);
+    frame[l].closed = 1;
+  }
+
+  EH_search_path& operator=(const EH_search_path &other) {
+    rsize = other.rsize;
+    tlevel = other.tlevel;
+    frame = other.frame;
+    p = other.p;
+    pos = other.pos;
+    open = other.open;
+    total_distance = other.total_distance;
+    pmode = other.pmode;
+    cand = other.cand;
+    cmask = other.cmask;
+    return *this;
+  }
+
+  void push_back(index_type ti) { enqueue(ti); }
+  void pop_back() { dequeue(); }
+
+  const graph_type& graph() const { return mygraph; }
+
+private:
+  struct level_frame {
+    level_frame() : child(0), cursor(0), weight(), closed(0) { }
+    index_type child, cursor;
+    value_type weight;
+    char closed;
+  };
+
+  size_type n() const { return mygraph.size(); }
+
+  static mask_type bit(index_type gi) { return mask_type(1) << gi; }
+  mask_type all() const { return (n() == N) ? ~mask_type(0) : bit(n()) - 1; }
+  // Nodes above gi (two shifts, since gi+1 may be N)
+  static mask_type above(index_type gi) { return (~mask_type(0) << gi) << 1; }
+
+  void init_state() {
+    for (index_type i=0; i<n(); i++) pos[p[i]] = i;
+    open = all();
+    for (index_type i=0; i<=global_level() && i<n(); i++) open &= ~bit(p[i]);
+  }
+
+  void place(index_type gi, index_type i) {
+    const index_type j = pos[gi];
+    std::swap(p[i], p[j]);
+    pos[p[i]] = i;
+    pos[p[j]] = j;
+  }
+
+  size_type anchor() const { return (pmode == free_start) ? 0 : 1; }
+
+  // The children sequence of EH_search_path: candidate list entries,
+  // then the nodes off the list in index order. first_child(last, s) is
+  // the first position from s on that holds a child; there must be one.
+  size_type num_candidates() const { return cand ? cand->size() : 0; }
+
+  index_type child_node(index_type last, index_type s) const
+  { return (s < num_candidates()) ? cand->begin(last)[s] : s - num_candidates(); }
+
+  index_type first_child(index_type last, index_type s) const {
+    const size_type nc = num_candidates();
+    for (; s < nc; s++)
+      if (open & bit(cand->begin(last)[s])) return s;
+    return nc + lowest_bit(static_cast<mask_type>(open & ~cmask[last] & (~mask_type(0) << (s - nc))));
+  }
+
+  void visit(index_type gi) {
+    const size_type gl = global_level();
+    place(gi, gl);
+    open &= ~bit(gi);
+    total_distance = frame[tlevel-1].weight + mygraph.distance(p[gl-1], gi);
+    if (pmode == closed_tour && gl+1 == n())
+      total_distance += mygraph.distance(gi, p[0]);
+  }
+
+  void leave() { open |= bit(p[global_level()]); }
+
+  /* path implementation */
+  size_type num_neighbor() const { return num_children(); }
+
+  index_type neighbor(index_type ti) const { return p[global_level() + 1 + ti]; }
+
+  /* tree implementation */
+  size_type whoami() const { return frame[tlevel].child; }
+
+  size_type num_children() const { return (n() - global_level() - 1) % n(); }
+
+  void enqueue(index_type i) {
+#ifndef NDEBUG
+    if (i >= num_children()) throw std::runtime_error("Invalid child");
+#endif
+    const index_type last = p[global_level()];
+    index_type s = first_child(last, 0);
+    for (index_type k=0; k<i; k++) s = first_child(last, s+1);
+    frame[tlevel].weight = total_distance;
+    tlevel++;
+    level_frame &f = frame[tlevel];
+    f.child = i;
+    f.cursor = s;
+    f.closed = 0;
+    visit(child_node(last, s));
+  }
+
+  void dequeue() {
+#ifndef NDEBUG
+    if (this->is_top()) throw std::runtime_error("No parent");
+#endif
+    leave();
+    tlevel--;
+    total_distance = frame[tlevel].weight;
+  }
+
+  void next_sibling() {
+#ifndef NDEBUG
+    if (!has_next_sibling()) throw std::runtime_error("Next child does not exist");
+#endif
+    leave();
+    const index_type last = p[global_level() - 1];
+    level_frame &f = frame[tlevel];
+    f.child++;
+    f.cursor = first_child(last, f.cursor + 1);
+    visit(child_node(last, f.cursor));
+  }
+
+  bool has_next_sibling() { return !frame[tlevel].closed && whoami() < num_sibling(); }
+
+  size_type num_sibling() const
+  { return num_children() % (n() - rsize - 1); }
+
+  index_type rsize, tlevel;
+  std::array<level_frame, N+1> frame;
+  container_type p, pos;
+  mask_type open;
+  value_type total_distance;
+  path_mode pmode;
+  const candidates_type *cand;
+  // Nodes on the candidate list of each node
+  std::array<mask_type, N> cmask;
+  const graph_type &mygraph;
+};
+
+// True for the search paths that keep the open nodes as a bitmask
+template <typename P> struct has_node_mask : std::false_type { };
+
+template <typename T, std::size_t N>
+struct has_node_mask< EH_search_path< T, fixed_set<T,N> > > : std::true_type { };
+
+
+#endif
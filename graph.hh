@@ -7,14 +7,57 @@
 #include <deque>
 #include <stdexcept>
 
-// Generic graph object
-template <typename T=double>
-class graph {
+// Generic graph object, statically polymorphic: graph type D derives
+// from basic_graph<D> and provides
+//
+//   size_type size() const                    number of nodes
+//   size_type num_neighbor(gi) const          neighbors of global node gi
+//   index_type neighbor(gi, j) const          global index of neighbor j of gi
+//   value_type weight(gi, j) const            (possibly directed) weight gi -> j
+//   value_type node_weight(gi) const          node weight at gi
+//
+// which the search calls directly, so they can be inlined. graph<T>
+// below is the same interface with virtual functions, for type erasure.
+template <typename D, typename T=double>
+class basic_graph {
 public:
   typedef std::size_t size_type;
   typedef size_type index_type;
   typedef T value_type;
 
+  // Returns true if the globally indexed nodes are neighbors
+  bool is_neighbor(index_type gi, index_type gj) const {
+    for (index_type j=0; j<derived().num_neighbor(gi); j++)
+      if (derived().neighbor(gi, j) == gj) return true;
+    return false;
+  }
+
+  // Return the neighbor index of the global index
+  index_type neighbor_index(index_type gi, index_type gj) const {
+#ifndef NDEBUG
+    if (!is_neighbor(gi, gj)) throw std::runtime_error("Not neighbors");
+#endif
+    index_type index = 0;
+    for (index_type j=0; j<derived().num_neighbor(gi); j++)
+      if (derived().neighbor(gi, j) == gj) { index = j; break; }
+    return index;
+  }
+
+protected:
+  ~basic_graph() { }
+
+private:
+  const D& derived() const { return static_cast<const D&>(*this); }
+};
+
+template <typename T=double>
+class graph : public basic_graph<graph<T>, T> {
+public:
+  typedef basic_graph<graph<T>, T> base_type;
+  typedef typename base_type::size_type size_type;
+  typedef typename base_type::index_type index_type;
+  typedef typename base_type::value_type value_type;
+
   // Return the size of the graph (number of nodes)
   virtual size_type size() const = 0;
 
@@ -30,25 +73,29 @@ public:
   // Return the node weight at global node gi
   virtual value_type node_weight(index_type gi) const = 0;
 
-  // Returns true if the globally indexed nodes are neighbors
-  bool is_neighbor(index_type gi, index_type gj) const {
-    for (index_type j=0; j<num_neighbor(gi); j++)
-      if (neighbor(gi, j) == gj) return true;
-    return false;
-  }
+  virtual ~graph() { }
+};
 
-  // Return the neighbor index of the global index
-  index_type neighbor_index(index_type gi, index_type gj) const {
-#ifndef NDEBUG
-    if (!is_neighbor(gi, gj)) throw std::runtime_error("Not neighbors");
-#endif
-    index_type index = 0;
-    for (index_type j=0; j<num_neighbor(gi); j++)
-      if (neighbor(gi, j) == gj) { index = j; break; }
-    return index;
-  }
+// A graph of static type G behind the virtual interface; g has to
+// outlive the adapter
+template <typename G>
+class graph_adapter : public graph<typename G::value_type> {
+public:
+  typedef graph<typename G::value_type> base_type;
+  typedef typename base_type::size_type size_type;
+  typedef typename base_type::index_type index_type;
+  typedef typename base_type::value_type value_type;
 
-  virtual ~graph() { }
+  explicit graph_adapter(const G &g) : mygraph(g) { }
+
+  size_type size() const { return mygraph.size(); }
+  size_type num_neighbor(index_type gi) const { return mygraph.num_neighbor(gi); }
+  index_type neighbor(index_type gi, index_type j) const { return mygraph.neighbor(gi, j); }
+  value_type weight(index_type gi, index_type j) const { return mygraph.weight(gi, j); }
+  value_type node_weight(index_type gi) const { return mygraph.node_weight(gi); }
+
+private:
+  const G &mygraph;
 };
 
 
@@ -1,23 +1,13 @@
 #include <omp.h>
 #include <iostream>
-#include <cmath>
-#include <array>
-#include <vector>
 #include <sstream>
+#include <string>
+#include <memory>
 
 #include "square_symmetric_matrix.hh"
-#include "Euclidean_impl.hh"
-#include "searchtask_impl.hh"
-
-typedef double real;
-typedef unsigned int index_type;
-typedef Euclidean_set<real> graph_type;
-typedef EH_search_path<real> spath_type;
-typedef Euclidean_path<real> gpath_type;
-
-typedef spath_type task_type;
-typedef spath_type answer_type;
-typedef search_manager<task_type, answer_type> manager_type;
+#include "solve_impl.hh"
+#include "instance_impl.hh"
+#include "matrixfile_impl.hh"
 
 
 graph_type example_graph() {
@@ -38,99 +28,157 @@ graph_type example_graph() {
   return graph_type(dt);
 }
 
-graph_type create_point_set(index_type c) {
-  using std::abs; using std::pow; using std::sin;
-  // ( |p1-q1|^(3/2) + |p2-q2|^(3/2) )^(2/3)
-  square_symmetric_matrix<real> dt(c);
-  std::vector< std::array<real,2> > point(c);
-
-#pragma omp parallel default(shared)
-  {
-#pragma omp for
-    for (unsigned int i=0; i<c; i++) {
-      point[i][0] = 100 * sin(i);
-      point[i][1] = 101 * cos(i*i);
-      // point[i][0] = 1.1 * (i*i   % 17);
-      // point[i][1] = 0.5 * (i*i*i % 23);
-    }
-
-#pragma omp for collapse(2)
-    for (unsigned int p=0; p<c; p++)
-      for (unsigned int q=0; q<c; q++)
-        dt(p,q) = pow(pow(abs(point[p][0] - point[q][0]), 1.5) +
-                      pow(abs(point[p][1] - point[q][1]), 1.5), 2./3.);
-  }
+// Optionally save g as a matrix file, then solve it and print the
+// answer, the time since start_time and the counters
+template <typename G>
+void solve_and_print(const G &g, solve_options opt, const std::string &save,
+                     real start_time, bool print_stats, bool stream) {
+  if (!save.empty()) write_matrix_file<real>(save, g);
+  const bool report = !opt.cluster || opt.cluster->coordinator();
+  if (stream && report)
+    opt.on_incumbent = [start_time](const std::vector<std::size_t> &order, double weight) {
+      std::cout << "Incumbent at " << omp_get_wtime() - start_time << " s: path:";
+      for (std::size_t i : order) std::cout << ' ' << i;
+      std::cout << " weight: " << weight << std::endl;
+    };
+  solve_stats stats;
+  auto sp = solve(g, opt, &stats);
+  // Only the coordinator of a distributed search reports
+  if (!report) return;
+
+  real end_time = omp_get_wtime();
 
-#ifndef NDEBUG
-  std::cout << dt << std::endl;
-#endif
-
-  return graph_type(dt);
-}
-
-
-void find_path_task(task_type &sp, manager_type &manager, const index_type branch_level) {
-  // Get current best answer
-  answer_type ans = manager.answer();
-  do {
-    sp.iterate_dfs();
-    if (sp > ans) {
-      // If the path is longer tan the currently cached bound, skip
-      // ahead to the next branch
-      sp.next_branch();
-    }
-    else if (sp.is_bottom()) {
-      // If we got here, the answer is better than the currently
-      // cached bound. In this case, submit it to the manager (which
-      // will ensure it's _actually_ better) and will return the
-      // newest best answer.
-      ans = manager.conclude(sp);
-    }
-    else if (sp.global_level() <= branch_level) {
-      // Branch off and submit back to the queue
-      while (!sp.last_branch())
-        manager.give(sp.split());
-    }
-  } while (!sp.is_top());
+  std::cout << sp << std::endl;
+  std::cout << "Elapsed time: " << end_time - start_time << std::endl;
+  if (opt.time_limit > 0 || opt.gap > 0) {
+    const real gap = (sp.weight() > 0) ? (sp.weight() - stats.lower_bound) / sp.weight() : 0;
+    std::cout << "Lower bound: " << stats.lower_bound << " gap: " << gap
+              << (stats.complete ? "" : " (time limit)") << std::endl;
+  }
+  if (print_stats) {
+    if (!search_counters::enabled)
+      std::cerr << "Counters are only collected when built with -DSEARCH_STATS" << std::endl;
+    write_counters_json(std::cout, stats.threads, start_time);
+    std::cout << std::endl;
+  }
 }
 
-const answer_type find_path(const graph_type &g, const index_type branch_level) {
-  task_type sp(g, 0);
-  manager_type manager(sp, longest_path(g));
-
-#pragma omp parallel shared(manager)
-  {
-    while (!manager.done())
-      if (manager.has_work()) {
-        task_type sp = manager.get();
-        find_path_task(sp, manager, branch_level);
-        manager.finish(sp);
-      }
-  }
-  return manager.answer();
+// The synthetic point set under metric M, searched through a table or
+// (implicit) straight from the coordinates
+template <typename M>
+void solve_points(index_type c, bool implicit, const solve_options &opt, const std::string &save,
+                  real start_time, bool print_stats, bool stream) {
+  if (implicit)
+    solve_and_print(create_coordinate_set<real,M>(c), opt, save, start_time, print_stats, stream);
+  else
+    solve_and_print(create_point_set<real,M>(c), opt, save, start_time, print_stats, stream);
 }
 
 int main(int argc, char *argv[]) {
-  real start_time, end_time;
-  index_type c, branch_level;
-  std::string prog;
+  real start_time;
+  index_type c;
+  std::string prog, bound_name("hk"), engine_name("auto"), mode_name("fixed"), select_name("lifo"),
+    metric("p1.5"), input, save, connect;
   std::stringstream ss;
-
-  if (argc != 3) throw std::runtime_error("Usage: " + prog + " c branch_level");
+  bool print_stats = false, implicit = false, stream = false;
+  solve_options opt;
+  index_type processes = 1;
+  int port = 0;
+
+  if (argc < 3)
+    throw std::runtime_error("Usage: " + prog + " c branch_level|auto [--bound=weight|mst|hk] [--restarts=k]"
+                             " [--engine=auto|bnb|dp|heuristic] [--dp-memory=MiB] [--mode=fixed|free|closed]"
+                             " [--candidates=k|none] [--select=lifo|fifo|best|hybrid] [--stats]"
+                             " [--metric=p1.5|l1|l2|linf] [--implicit] [--kernels=fixed|generic]"
+                             " [--dominance=MiB] [--checkpoint=file] [--checkpoint-interval=seconds]"
+                             " [--resume=file] [--processes=k] [--listen=port] [--connect=host:port]"
+                             " [--time-limit=seconds] [--gap=fraction] [--stream]"
+                             " [--input=file] [--save=file]");
   for (int i=0; i<3; i++) ss << argv[i] << ' ';
-  ss >> prog >> c >> branch_level;
-  std::cout << "Call: " << prog << " " << c << " " << branch_level << std::endl;
+  std::string level;
+  ss >> prog >> c >> level;
+  opt.branch_level = (level == "auto") ? adaptive_level : std::stoul(level);
+  for (int i=3; i<argc; i++) {
+    std::string arg(argv[i]);
+    if (arg.compare(0, 8, "--bound=") == 0) bound_name = arg.substr(8);
+    else if (arg.compare(0, 11, "--restarts=") == 0) opt.restarts = std::stoul(arg.substr(11));
+    else if (arg.compare(0, 9, "--engine=") == 0) engine_name = arg.substr(9);
+    else if (arg.compare(0, 12, "--dp-memory=") == 0) opt.dp_memory = std::stoul(arg.substr(12)) << 20;
+    else if (arg.compare(0, 7, "--mode=") == 0) mode_name = arg.substr(7);
+    else if (arg == "--candidates=none") opt.nearest_first = false;
+    else if (arg.compare(0, 13, "--candidates=") == 0) opt.candidates = std::stoul(arg.substr(13));
+    else if (arg.compare(0, 9, "--select=") == 0) select_name = arg.substr(9);
+    else if (arg == "--stats") print_stats = true;
+    else if (arg.compare(0, 9, "--metric=") == 0) metric = arg.substr(9);
+    else if (arg == "--implicit") implicit = true;
+    else if (arg == "--kernels=fixed") opt.fixed_kernels = true;
+    else if (arg == "--kernels=generic") opt.fixed_kernels = false;
+    else if (arg.compare(0, 12, "--dominance=") == 0) opt.dominance_memory = std::stoul(arg.substr(12)) << 20;
+    else if (arg.compare(0, 13, "--checkpoint=") == 0) opt.checkpoint = arg.substr(13);
+    else if (arg.compare(0, 22, "--checkpoint-interval=") == 0)
+      opt.checkpoint_interval = std::stod(arg.substr(22));
+    else if (arg.compare(0, 9, "--resume=") == 0) opt.resume = arg.substr(9);
+    else if (arg.compare(0, 12, "--processes=") == 0) processes = std::stoul(arg.substr(12));
+    else if (arg.compare(0, 9, "--listen=") == 0) port = std::stoi(arg.substr(9));
+    else if (arg.compare(0, 10, "--connect=") == 0) connect = arg.substr(10);
+    else if (arg.compare(0, 13, "--time-limit=") == 0) opt.time_limit = std::stod(arg.substr(13));
+    else if (arg.compare(0, 6, "--gap=") == 0) opt.gap = std::stod(arg.substr(6));
+    else if (arg == "--stream") stream = true;
+    else if (arg.compare(0, 8, "--input=") == 0) input = arg.substr(8);
+    else if (arg.compare(0, 7, "--save=") == 0) save = arg.substr(7);
+    else throw std::runtime_error("Unknown option: " + arg);
+  }
+  opt.bound = parse_bound(bound_name);
+  opt.engine = parse_engine(engine_name);
+  opt.mode = parse_mode(mode_name);
+  opt.select = parse_select(select_name);
+  std::cout << "Call: " << prog << " " << c << " " << level
+            << " --bound=" << bound_name << " --restarts=" << opt.restarts
+            << " --engine=" << engine_name << " --mode=" << mode_name << " --candidates=";
+  if (opt.nearest_first) std::cout << opt.candidates;
+  else std::cout << "none";
+  std::cout << " --select=" << select_name
+            << " --kernels=" << (opt.fixed_kernels ? "fixed" : "generic")
+            << " --dominance=" << (opt.dominance_memory >> 20);
+  if (!opt.checkpoint.empty())
+    std::cout << " --checkpoint=" << opt.checkpoint << " --checkpoint-interval=" << opt.checkpoint_interval;
+  if (!opt.resume.empty()) std::cout << " --resume=" << opt.resume;
+  if (processes > 1) std::cout << " --processes=" << processes;
+  if (port > 0) std::cout << " --listen=" << port;
+  if (!connect.empty()) std::cout << " --connect=" << connect;
+  if (opt.time_limit > 0) std::cout << " --time-limit=" << opt.time_limit;
+  if (opt.gap > 0) std::cout << " --gap=" << opt.gap;
+  if (stream) std::cout << " --stream";
+  if (input.empty()) std::cout << " --metric=" << metric << (implicit ? " --implicit" : "");
+  else std::cout << " --input=" << input;
+  std::cout << std::endl;
+
+  // Distributed search: local workers are forked off here, before any
+  // threads start; workers elsewhere connect to the coordinator
+  std::unique_ptr<search_cluster> cluster;
+  if (!connect.empty()) {
+    const std::size_t colon = connect.rfind(':');
+    if (colon == std::string::npos) throw std::runtime_error("--connect needs host:port");
+    cluster.reset(new search_cluster(connect.substr(0, colon), std::stoi(connect.substr(colon + 1))));
+  }
+  else if (processes > 1 || port > 0) cluster.reset(new search_cluster(processes, port));
+  opt.cluster = cluster.get();
 
   start_time = omp_get_wtime();
 
+  // Matrix files are searched in place; anything else is read into memory
   // auto ps = example_graph();
-  auto ps = create_point_set(c);
-  auto sp = find_path(ps, branch_level);
-
-  end_time = omp_get_wtime();
-
-  std::cout << sp << std::endl;
-  std::cout << "Elapsed time: " << end_time - start_time << std::endl;
+  if (input.empty()) {
+    if (metric == "p1.5") solve_points<Minkowski15_metric>(c, implicit, opt, save, start_time, print_stats, stream);
+    else if (metric == "l1") solve_points<L1_metric>(c, implicit, opt, save, start_time, print_stats, stream);
+    else if (metric == "l2") solve_points<L2_metric>(c, implicit, opt, save, start_time, print_stats, stream);
+    else if (metric == "linf") solve_points<Linf_metric>(c, implicit, opt, save, start_time, print_stats, stream);
+    else throw std::runtime_error("Unknown metric: " + metric);
+  }
+  else if (is_matrix_file(input))
+    solve_and_print(map_matrix_file<real>(input), opt, save, start_time, print_stats, stream);
+  else
+    solve_and_print(read_tsplib<real>(input), opt, save, start_time, print_stats, stream);
 
   return 0;
 }
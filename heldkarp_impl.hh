@@ -0,0 +1,175 @@
+#ifndef HELDKARP_IMPL_HH
+#define HELDKARP_IMPL_HH
+
+// Held-Karp dynamic program for the shortest path or tour: O(2^n n^2)
+// time, independent of the instance, which makes it the better engine
+// for small graphs.
+#include "path.hh"
+#include <omp.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <limits>
+#include <stdexcept>
+#include <algorithm>
+
+// The nodes other than the first are renumbered 0..m-1 (all n nodes if
+// the first is free). D(j, T) is the weight of the shortest path from
+// the first node (any node in T if free) through the set T (which
+// excludes j) ending at j. Since j is never in T, T is stored
+// with bit j squeezed out, giving a table of m 2^(m-1) entries:
+//   D(j, T) = table[j 2^(m-1) + squeeze(T, j)]
+template <typename T>
+class held_karp_table {
+public:
+  typedef T value_type;
+  typedef std::size_t size_type;
+  typedef std::uint32_t set_type;
+
+  // Largest supported m (one bit per node in set_type)
+  enum { max_nodes = 31 };
+
+  // Bytes needed for the table over a graph of n nodes
+  static size_type bytes(size_type n, path_mode mode=fixed_start) {
+    if (n < 2) return 0;
+    const size_type m = (mode == free_start) ? n : n - 1;
+    if (m > max_nodes) return std::numeric_limits<size_type>::max();
+    return m * (size_type(1) << (m-1)) * sizeof(value_type);
+  }
+
+  held_karp_table(size_type m) :
+    half(size_type(1) << (m-1)), data(m * half) { }
+
+  // Reshape for m nodes; the storage is only ever grown
+  void resize(size_type m) {
+    half = size_type(1) << (m-1);
+    data.resize(std::max(data.size(), m * half));
+  }
+
+  value_type& operator()(size_type j, set_type t)
+  { return data[j*half + squeeze(t, j)]; }
+
+  const value_type& operator()(size_type j, set_type t) const
+  { return data[j*half + squeeze(t, j)]; }
+
+private:
+  // Remove bit j from t
+  static set_type squeeze(set_type t, size_type j) {
+    const set_type low = (set_type(1) << j) - 1;
+    return (t & low) | ((t >> (j+1)) << j);
+  }
+
+  size_type half;
+  std::vector<value_type> data;
+};
+
+
+// Half of physical memory; the default limit for the table
+inline std::size_t held_karp_memory_limit() {
+  const long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGE_SIZE);
+  if (pages <= 0 || page <= 0) return std::size_t(1) << 30;
+  return static_cast<std::size_t>(pages) * static_cast<std::size_t>(page) / 2;
+}
+
+// True if the table for g fits in `limit` bytes
+template <typename G>
+bool held_karp_fits(const G &g, std::size_t limit, path_mode mode=fixed_start) {
+  return held_karp_table<typename G::value_type>::bytes(g.size(), mode) <= limit;
+}
+
+// Shortest path through all nodes of g starting at `start` (ignored for
+// free paths), or shortest tour through `start`, written to order (n
+// entries). D is the table, reshaped to fit. Each layer of sets of equal
+// size depends only on the one before, so if parallel, the sets of a
+// layer are spread over the OpenMP threads.
+template <typename G>
+void held_karp_order(const G &g, std::size_t start, path_mode mode,
+                     held_karp_table<typename G::value_type> &D, std::size_t *order,
+                     bool parallel=true) {
+  typedef std::size_t index_type;
+  typedef typename G::value_type value_type;
+  typedef held_karp_table<value_type> table_type;
+  typedef typename table_type::set_type set_type;
+
+  const std::size_t n = g.size();
+  const bool any_start = (mode == free_start);
+  if (n < 2) { std::fill(order, order + n, start); return; }
+  const std::size_t m = any_start ? n : n - 1;
+  if (m > table_type::max_nodes)
+    throw std::runtime_error("held_karp_order(): graph too large");
+
+  // node[a] is the graph node renumbered to a
+  std::array<index_type, table_type::max_nodes> node;
+  for (index_type i=0, a=0; i<n; i++) if (any_start || i != start) node[a++] = i;
+
+  D.resize(m);
+  const set_type full = static_cast<set_type>((std::uint64_t(1) << m) - 1);
+  for (index_type j=0; j<m; j++)
+    D(j, 0) = any_start ? value_type() : g.distance(start, node[j]);
+
+  for (std::size_t k=1; k<m; k++) {
+#pragma omp parallel for schedule(static) default(shared) if(parallel)
+    for (std::int64_t s=0; s<=static_cast<std::int64_t>(full); s++) {
+      const set_type t = static_cast<set_type>(s);
+      if (static_cast<std::size_t>(__builtin_popcount(t)) != k) continue;
+      for (index_type j=0; j<m; j++) {
+        if (t & (set_type(1) << j)) continue;
+        value_type best = std::numeric_limits<value_type>::max();
+        for (set_type rest=t; rest; rest &= rest-1) {
+          const index_type i = __builtin_ctz(rest);
+          const value_type w = D(i, t & ~(set_type(1) << i)) + g.distance(node[i], node[j]);
+          if (w < best) best = w;
+        }
+        D(j, t) = best;
+      }
+    }
+  }
+
+  // Walk back from the best last node (counting the return edge of a
+  // tour), redoing each minimisation; order fills from the back
+  index_type j = 0;
+  value_type best_total = std::numeric_limits<value_type>::max();
+  for (index_type a=0; a<m; a++) {
+    value_type total = D(a, full & ~(set_type(1) << a));
+    if (mode == closed_tour) total += g.distance(node[a], start);
+    if (total < best_total) { best_total = total; j = a; }
+  }
+  set_type t = full & ~(set_type(1) << j);
+  std::size_t at = n;
+  order[--at] = node[j];
+  while (t) {
+    index_type prev = m;
+    value_type best = std::numeric_limits<value_type>::max();
+    for (set_type rest=t; rest; rest &= rest-1) {
+      const index_type i = __builtin_ctz(rest);
+      const value_type w = D(i, t & ~(set_type(1) << i)) + g.distance(node[i], node[j]);
+      if (prev == m || w < best) { prev = i; best = w; }
+    }
+    t &= ~(set_type(1) << prev);
+    j = prev;
+    order[--at] = node[j];
+  }
+  if (!any_start) order[0] = start;
+
+  // Same orientation as the branch-and-bound searches
+  if (any_start && order[n-1] < order[0])
+    std::reverse(order, order + n);
+  if (mode == closed_tour && n > 2 && order[n-1] < order[1])
+    std::reverse(order + 1, order + n);
+}
+
+// The same with a table of its own, sized for g
+template <typename G>
+std::vector<std::size_t> held_karp_order(const G &g, std::size_t start,
+                                         path_mode mode=fixed_start) {
+  std::vector<std::size_t> order(g.size());
+  if (g.size() < 2) { std::fill(order.begin(), order.end(), start); return order; }
+  held_karp_table<typename G::value_type> D((mode == free_start) ? g.size() : g.size() - 1);
+  held_karp_order(g, start, mode, D, order.data());
+  return order;
+}
+
+
+#endif
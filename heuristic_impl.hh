@@ -0,0 +1,238 @@
+#ifndef HEURISTIC_IMPL_HH
+#define HEURISTIC_IMPL_HH
+
+// Construction and local search heuristics for paths and tours. They
+// are used to seed the branch-and-bound with a good answer before the
+// search starts.
+#include "path.hh"
+#include <omp.h>
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+
+// Weight of the path (or tour) visiting the nodes in order
+template <typename G>
+typename G::value_type order_weight(const G &g, const std::vector<std::size_t> &order,
+                                    path_mode mode=fixed_start) {
+  typename G::value_type w = typename G::value_type();
+  for (std::size_t i=1; i<order.size(); i++) w += g.distance(order[i-1], order[i]);
+  if (mode == closed_tour && !order.empty()) w += g.distance(order.back(), order.front());
+  return w;
+}
+
+// Nearest-neighbour path from start. With a generator, each step picks
+// uniformly among the (up to) `width` nearest unvisited nodes instead.
+template <typename G, typename R>
+std::vector<std::size_t> nearest_neighbour_order(const G &g, std::size_t start,
+                                                 R *rng, std::size_t width=3) {
+  typedef std::size_t index_type;
+  typedef typename G::value_type value_type;
+  const std::size_t n = g.size();
+  std::vector<index_type> order(n), best(width);
+  std::vector<value_type> bestd(width), dist(n);
+  std::iota(order.begin(), order.end(), 0);
+  std::swap(order[0], order[start]);
+
+  for (index_type i=1; i<n; i++) {
+    // order[i,n) holds the unvisited nodes; keep the nearest sorted
+    index_type nbest = 0;
+    g.distances(order[i-1], order.data()+i, n-i, dist.data()+i);
+    for (index_type a=i; a<n; a++) {
+      const value_type d = dist[a];
+      index_type k;
+      if (nbest < width) k = nbest++;
+      else if (d < bestd[width-1]) k = width-1;
+      else continue;
+      for (; k>0 && d < bestd[k-1]; k--) { best[k] = best[k-1]; bestd[k] = bestd[k-1]; }
+      best[k] = a; bestd[k] = d;
+    }
+    index_type pick = 0;
+    if (rng) pick = std::uniform_int_distribution<index_type>(0, nbest-1)(*rng);
+    std::swap(order[i], order[best[pick]]);
+  }
+  return order;
+}
+
+// The plain nearest-neighbour path from start, written to order[0, n)
+// (ties go to the same nodes as above)
+template <typename G>
+void nearest_neighbour_order(const G &g, std::size_t start, std::size_t *order) {
+  const std::size_t n = g.size();
+  std::iota(order, order + n, 0);
+  std::swap(order[0], order[start]);
+  for (std::size_t i=1; i<n; i++) {
+    std::size_t best = i;
+    for (std::size_t a=i+1; a<n; a++)
+      if (g.distance(order[i-1], order[a]) < g.distance(order[i-1], order[best])) best = a;
+    std::swap(order[i], order[best]);
+  }
+}
+
+// 2-opt and Or-opt on a cycle c[0,L) whose position 0 never moves:
+//   closed_tour: the tour itself
+//   fixed_start: the path followed by a dummy node, which stays put too
+//   free_start:  a dummy node followed by the path
+// The dummy (node n) is at distance zero from every node, so the cycle
+// weighs as much as the path. Moves only touch positions [lo, hi].
+// assign() starts over with another order, in the same storage.
+template <typename G>
+class local_search_cycle {
+public:
+  typedef std::size_t size_type;
+  typedef size_type index_type;
+  typedef typename G::value_type value_type;
+  typedef std::vector<index_type> container_type;
+
+  local_search_cycle(const G &g, const container_type &order, path_mode m) :
+    mygraph(g), mode(m), dummy(), lo(1), hi(0), c(), seg()
+  { assign(order.data(), order.data() + order.size()); }
+
+  // Start over from the path [first, last) through all nodes of the
+  // graph, which may have changed size
+  void assign(const index_type *first, const index_type *last) {
+    dummy = mygraph.size();
+    c.clear();
+    if (mode == free_start) c.push_back(dummy);
+    c.insert(c.end(), first, last);
+    if (mode == fixed_start) c.push_back(dummy);
+    hi = c.size() - ((mode == fixed_start) ? 2 : 1);
+  }
+
+  // The path (or tour) in its searched orientation: free paths end above
+  // their first node, tours have their second node below their last
+  container_type order() const {
+    container_type o(c.size() - ((mode == closed_tour) ? 0 : 1));
+    order(o.data());
+    return o;
+  }
+
+  // The same, written to out
+  void order(index_type *out) const {
+    const std::size_t n = c.size() - ((mode == closed_tour) ? 0 : 1);
+    std::copy(c.begin() + ((mode == free_start) ? 1 : 0), c.begin() + ((mode == free_start) ? 1 : 0) + n, out);
+    if (mode == free_start && n > 1 && out[n-1] < out[0])
+      std::reverse(out, out + n);
+    if (mode == closed_tour && n > 2 && out[n-1] < out[1])
+      std::reverse(out + 1, out + n);
+  }
+
+  // Alternate 2-opt and Or-opt until neither improves
+  void optimise() {
+    two_opt();
+    while (or_opt() && two_opt()) { }
+  }
+
+  // Reverse c[i,j] whenever that shortens the cycle
+  bool two_opt() {
+    bool improved = false, again = true;
+    while (again) {
+      again = false;
+      for (index_type i=lo; i<hi; i++)
+        for (index_type j=i+1; j<=hi; j++) {
+          const index_type nj = next(j);
+          const value_type removed = dist(c[i-1], c[i]) + dist(c[j], c[nj]);
+          const value_type delta = dist(c[i-1], c[j]) + dist(c[i], c[nj]) - removed;
+          if (delta < -tolerance(removed)) {
+            std::reverse(c.begin()+i, c.begin()+j+1);
+            improved = again = true;
+          }
+        }
+    }
+    return improved;
+  }
+
+  // Move segments of up to three nodes (possibly reversed) between two
+  // other neighbours whenever that shortens the cycle
+  bool or_opt() {
+    bool improved = false, again = true;
+    while (again) {
+      again = false;
+      for (index_type len=1; len<=3; len++)
+        for (index_type i=lo; i+len-1<=hi; i++) {
+          const index_type j = i + len - 1; // segment is c[i,j]
+          const value_type cut = dist(c[i-1], c[i]) + dist(c[j], c[next(j)]);
+          const value_type removed = cut - dist(c[i-1], c[next(j)]);
+          // Insert between positions k and k+1, outside the segment
+          for (index_type k=lo-1; k<=hi; k++) {
+            if (k+1 >= i && k <= j) continue;
+            const index_type nk = next(k);
+            const value_type fwd = dist(c[k], c[i]) + dist(c[j], c[nk]) - dist(c[k], c[nk]);
+            const value_type rev = dist(c[k], c[j]) + dist(c[i], c[nk]) - dist(c[k], c[nk]);
+            if (std::min(fwd, rev) - removed < -tolerance(cut + dist(c[k], c[nk]))) {
+              seg.assign(c.begin()+i, c.begin()+j+1);
+              if (rev < fwd) std::reverse(seg.begin(), seg.end());
+              c.erase(c.begin()+i, c.begin()+j+1);
+              const index_type at = (k < i) ? k+1 : k+1-len;
+              c.insert(c.begin()+at, seg.begin(), seg.end());
+              improved = again = true;
+              break;
+            }
+          }
+        }
+    }
+    return improved;
+  }
+
+private:
+  index_type next(index_type i) const { return (i+1 == c.size()) ? 0 : i+1; }
+
+  value_type dist(index_type a, index_type b) const
+  { return (a == dummy || b == dummy) ? value_type() : mygraph.distance(a, b); }
+
+  // Improvements below rounding noise are ignored so the loops end;
+  // scale is the weight of the edges a move removes. Metrics with many
+  // exact ties (L1, Linf) otherwise cycle on zero-gain moves.
+  static value_type tolerance(value_type scale)
+  { return 4 * std::numeric_limits<value_type>::epsilon() * std::abs(scale); }
+
+  const G &mygraph;
+  path_mode mode;
+  index_type dummy, lo, hi;
+  // seg holds the segment an Or-opt move carries
+  container_type c, seg;
+};
+
+// Alternate 2-opt and Or-opt until neither improves the path
+template <typename G>
+void local_search(const G &g, std::vector<std::size_t> &order, path_mode mode=fixed_start) {
+  if (order.size() < 3) return;
+  local_search_cycle<G> cycle(g, order, mode);
+  cycle.optimise();
+  order = cycle.order();
+}
+
+// Best of `restarts` locally optimised nearest-neighbour paths. The
+// first is the plain nearest-neighbour path from start, the others are
+// randomised (and for free paths start from other nodes in turn); they
+// are spread over the OpenMP threads. Ties go to the lowest restart so
+// the result does not depend on scheduling.
+template <typename G>
+std::vector<std::size_t> heuristic_order(const G &g, std::size_t start, std::size_t restarts,
+                                         path_mode mode=fixed_start) {
+  typedef std::size_t index_type;
+  typedef typename G::value_type value_type;
+  std::vector<index_type> best;
+  value_type best_weight = std::numeric_limits<value_type>::max();
+  index_type best_r = restarts;
+
+#pragma omp parallel for schedule(dynamic) default(shared)
+  for (index_type r=0; r<restarts; r++) {
+    std::mt19937 rng(r);
+    const index_type first = (mode == free_start) ? (start + r) % g.size() : start;
+    std::vector<index_type> order =
+      nearest_neighbour_order(g, first, (r == 0) ? nullptr : &rng);
+    local_search(g, order, mode);
+    const value_type w = order_weight(g, order, mode);
+#pragma omp critical (heuristic_order)
+    if (w < best_weight || (w == best_weight && r < best_r))
+      { best_weight = w; best_r = r; best.swap(order); }
+  }
+  return best;
+}
+
+
+#endif
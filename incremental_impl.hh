@@ -0,0 +1,175 @@
+#ifndef INCREMENTAL_IMPL_HH
+#define INCREMENTAL_IMPL_HH
+
+// Solving a graph again after some of its distances changed. The last
+// answer, weighed anew, is where the search starts, and the last lower
+// bound moved by the changes tells how far it can be from the optimum:
+// any path weighs at least the old optimum plus the decreases on its
+// edges. When the answer reaches that bound (for instance when every
+// change is an increase off the answer or a decrease on it), no search
+// is needed at all. Otherwise the answer, polished by local search,
+// seeds a search that ends as soon as it reaches the bound, with the
+// candidate lists and bounds of the last search.
+#include <omp.h>
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#include "solve_impl.hh"
+
+// Entry (i, j) of the distance matrix is now distance
+template <typename T>
+struct distance_change {
+  std::size_t i, j;
+  T distance;
+};
+
+// Solves a graph of type G, which must have set_distance(), and solves
+// it again after each batch of changes. The solver keeps its own copy of
+// the graph, which the changes are applied to.
+template <typename G>
+class incremental_solver {
+public:
+  typedef G graph_type;
+  typedef typename G::value_type value_type;
+  typedef typename search_types<G>::answer_type answer_type;
+  typedef distance_change<value_type> change_type;
+
+  incremental_solver(const G &g, const solve_options &o) :
+    mygraph(g), opt(o), dp(false), g32(), g64(), cache(), cache32(), cache64(),
+    last(), last_bound(0), solved(false) {
+    if (!opt.checkpoint.empty() || !opt.resume.empty() || opt.cluster)
+      throw std::runtime_error("Checkpoints and distributed searches apply to single solves");
+    if (opt.engine == heuristic_engine)
+      throw std::runtime_error("The heuristic engine has no lower bound to update");
+    const bool fits = held_karp_fits(mygraph, opt.dp_memory, opt.mode);
+    // solve() also answers graphs too small to search
+    dp = (opt.engine == dp_engine) || (opt.engine == auto_engine && mygraph.size() <= dp_auto_max && fits)
+      || mygraph.size() < 2;
+    if (!dp && opt.fixed_kernels && mygraph.size() > 1) {
+      if (mygraph.size() <= 32) g32.reset(new fixed_set<value_type,32>(mygraph));
+      else if (mygraph.size() <= fixed_max) g64.reset(new fixed_set<value_type,fixed_max>(mygraph));
+    }
+  }
+
+  const G& graph() const { return mygraph; }
+
+  // Solve from scratch
+  answer_type solve(solve_stats *stats=nullptr) {
+    return search(search_checkpoint(), 0, stats);
+  }
+
+  // Apply the changes and solve again. Changes to the same entry count
+  // in order; the first call solves from scratch.
+  answer_type update(const std::vector<change_type> &changes, solve_stats *stats=nullptr) {
+    // Net change per entry, at the first index of that entry
+    std::vector<value_type> delta(changes.size(), value_type());
+    for (std::size_t k=0; k<changes.size(); k++) {
+      const change_type &c = changes[k];
+      if (c.i >= mygraph.size() || c.j >= mygraph.size() || c.i == c.j)
+        throw std::runtime_error("update(): bad distance change");
+      std::size_t first = k;
+      for (std::size_t a=0; a<k; a++)
+        if (same_entry(changes[a], c)) { first = a; break; }
+      delta[first] += c.distance - mygraph.distance(c.i, c.j);
+      apply(c);
+    }
+    if (!solved) return solve(stats);
+
+    // The last answer in the changed graph, and the least any path
+    // can weigh now
+    value_type lb = last_bound;
+    for (const value_type d : delta) lb += std::min(d, value_type());
+    value_type w = order_weight(mygraph, last, opt.mode);
+    const value_type slack = 4 * std::numeric_limits<value_type>::epsilon() * mygraph.size() * w;
+    if (w * (1 - opt.gap) <= lb + slack) {
+      if (stats) {
+        *stats = solve_stats();
+        stats->incumbents.emplace_back(omp_get_wtime(), w);
+        stats->lower_bound = std::min(lb, w);
+        stats->complete = true;
+      }
+      if (opt.on_incumbent) opt.on_incumbent(last, w);
+      return answer_type(mygraph, last, opt.mode);
+    }
+
+    search_checkpoint start;
+    std::vector<std::size_t> seed = last;
+    local_search(mygraph, seed, opt.mode);
+    start.answer.assign(seed.begin(), seed.end());
+    start.weight = order_weight(mygraph, seed, opt.mode);
+    return search(start, lb, stats);
+  }
+
+private:
+  static bool same_entry(const change_type &a, const change_type &b)
+  { return (a.i == b.i && a.j == b.j) || (a.i == b.j && a.j == b.i); }
+
+  // Change the distance in every copy and drop what depended on it
+  void apply(const change_type &c) {
+    mygraph.set_distance(c.i, c.j, c.distance);
+    if (g32) g32->set_distance(c.i, c.j, c.distance);
+    if (g64) g64->set_distance(c.i, c.j, c.distance);
+    rebuild(cache, c);
+    rebuild(cache32, c);
+    rebuild(cache64, c);
+  }
+
+  template <typename S>
+  static void rebuild(search_cache<S> &kept, const change_type &c) {
+    if (!kept.cand) return;
+    kept.cand->rebuild(c.i);
+    kept.cand->rebuild(c.j);
+  }
+
+  // Solve from start (from scratch if it has no answer) with floor as
+  // the known lower bound, and keep the answer and its lower bound
+  answer_type search(const search_checkpoint &start, value_type floor, solve_stats *stats) {
+    solve_stats local;
+    if (!stats) stats = &local;
+    solve_options o = opt;
+    o.floor = floor;
+    const answer_type a = dp ? ::solve(mygraph, o, stats)
+      : g32 ? search_over(*g32, cache32, o, start, stats)
+      : g64 ? search_over(*g64, cache64, o, start, stats)
+      : search_over(mygraph, cache, o, start, stats);
+    // A search that reached the floor knows as much
+    last_bound = std::max<value_type>(stats->lower_bound, std::min<value_type>(floor, a.weight()));
+    stats->lower_bound = last_bound;
+    last.assign(a.begin(), a.end());
+    solved = (a.size() == mygraph.size());
+    return a;
+  }
+
+  template <typename S>
+  answer_type search_over(const S &sg, search_cache<S> &kept, const solve_options &o,
+                          const search_checkpoint &start, solve_stats *stats) {
+    search_checkpoint c = root_tasks(sg, o.mode);
+    c.weight = start.weight;
+    c.answer = start.answer;
+    const auto sp = search_tasks(sg, o, c, stats, nullptr, &kept);
+    if (sp.size() < mygraph.size()) return longest_path(mygraph);
+    return answer_type(mygraph, typename answer_type::container_type(sp.begin(), sp.end()), o.mode);
+  }
+
+  G mygraph;
+  solve_options opt;
+  // The dynamic program, or the fixed-size kernels if one of the copies
+  // is there
+  bool dp;
+  std::unique_ptr< fixed_set<value_type,32> > g32;
+  std::unique_ptr< fixed_set<value_type,fixed_max> > g64;
+  search_cache<G> cache;
+  search_cache< fixed_set<value_type,32> > cache32;
+  search_cache< fixed_set<value_type,fixed_max> > cache64;
+  // The last answer and a lower bound on its graph
+  std::vector<std::size_t> last;
+  value_type last_bound;
+  bool solved;
+};
+
+
+#endif
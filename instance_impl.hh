@@ -0,0 +1,168 @@
+#ifndef INSTANCE_IMPL_HH
+#define INSTANCE_IMPL_HH
+
+// Problem instances: the synthetic point set and TSPLIB files
+#include "square_symmetric_matrix.hh"
+#include "Euclidean_impl.hh"
+#include "coordinate_impl.hh"
+#include <cstddef>
+#include <cmath>
+#include <array>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+
+// c points on sin/cos curves, as an implicit graph under metric M
+template <typename T=double, typename M=Minkowski15_metric>
+coordinate_set<T,M> create_coordinate_set(std::size_t c) {
+  coordinate_set<T,M> g(c);
+  for (std::size_t i=0; i<c; i++) {
+    const unsigned int u = i;
+    g.set_point(i, 100 * std::sin(u), 101 * std::cos(u*u));
+    // g.set_point(i, 1.1 * (u*u % 17), 0.5 * (u*u*u % 23));
+  }
+  return g;
+}
+
+// The same points with their distances tabulated, Minkowski (p = 3/2)
+// by default
+template <typename T=double, typename M=Minkowski15_metric>
+Euclidean_set<T> create_point_set(std::size_t c) {
+  typename Euclidean_set<T>::table_type dt(c);
+  create_coordinate_set<T,M>(c).fill(dt);
+
+#ifndef NDEBUG
+  std::cout << dt << std::endl;
+#endif
+
+  return Euclidean_set<T>(std::move(dt));
+}
+
+
+// TSPLIB distance between points a and b for the given EDGE_WEIGHT_TYPE
+// (EUC_2D, EUC_3D, CEIL_2D, MAN_2D, MAN_3D, MAX_2D, MAX_3D, ATT, GEO)
+inline double tsplib_distance(const std::string &type, const std::array<double,3> &a,
+                              const std::array<double,3> &b) {
+  using std::abs; using std::sqrt; using std::floor;
+  const double dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+  // nint() in the TSPLIB documentation
+  auto nint = [](double x) { return floor(x + 0.5); };
+  if (type == "EUC_2D" || type == "EUC_3D") return nint(sqrt(dx*dx + dy*dy + dz*dz));
+  if (type == "CEIL_2D") return std::ceil(sqrt(dx*dx + dy*dy));
+  if (type == "MAN_2D" || type == "MAN_3D") return nint(abs(dx) + abs(dy) + abs(dz));
+  if (type == "MAX_2D" || type == "MAX_3D")
+    return std::max(nint(abs(dx)), std::max(nint(abs(dy)), nint(abs(dz))));
+  if (type == "ATT") {
+    const double r = sqrt((dx*dx + dy*dy) / 10.0), t = nint(r);
+    return (t < r) ? t + 1 : t;
+  }
+  if (type == "GEO") {
+    // Coordinates are DDD.MM (degrees and minutes)
+    const double pi = 3.141592, radius = 6378.388;
+    auto radians = [&](double x) {
+      const double deg = static_cast<double>(static_cast<long>(x));
+      return pi * (deg + 5.0 * (x - deg) / 3.0) / 180.0;
+    };
+    const double q1 = std::cos(radians(a[1]) - radians(b[1]));
+    const double q2 = std::cos(radians(a[0]) - radians(b[0]));
+    const double q3 = std::cos(radians(a[0]) + radians(b[0]));
+    return static_cast<double>(static_cast<long>(
+      radius * std::acos(0.5 * ((1.0 + q1) * q2 - (1.0 - q1) * q3)) + 1.0));
+  }
+  throw std::runtime_error("Unsupported EDGE_WEIGHT_TYPE " + type);
+}
+
+// Symmetric TSPLIB file, with coordinates (NODE_COORD_SECTION) or an
+// explicit matrix (EDGE_WEIGHT_TYPE EXPLICIT, EDGE_WEIGHT_SECTION in any
+// of the FULL_MATRIX, {UPPER,LOWER}[_DIAG]_{ROW,COL} formats).
+// Distances follow the TSPLIB definitions, rounding included.
+template <typename T=double>
+Euclidean_set<T> read_tsplib(const std::string &filename) {
+  std::ifstream in(filename.c_str());
+  if (!in) throw std::runtime_error("Cannot open " + filename);
+
+  std::size_t n = 0;
+  std::string line, weight_type, weight_format("FULL_MATRIX");
+  std::vector< std::array<double,3> > point;
+  std::vector<double> weights;
+  while (std::getline(in, line)) {
+    const std::size_t colon = line.find(':');
+    std::istringstream ls(colon == std::string::npos ? line : line.substr(0, colon));
+    std::string key;
+    ls >> key;
+    std::string value = (colon == std::string::npos) ? "" : line.substr(colon + 1);
+    value.erase(0, value.find_first_not_of(" \t"));
+    value.erase(value.find_last_not_of(" \t\r") + 1);
+
+    if (key == "TYPE" && value != "TSP")
+      throw std::runtime_error(filename + ": unsupported TYPE " + value);
+    else if (key == "DIMENSION") n = std::stoul(value);
+    else if (key == "EDGE_WEIGHT_TYPE") weight_type = value;
+    else if (key == "EDGE_WEIGHT_FORMAT") weight_format = value;
+    else if (key == "NODE_COORD_SECTION") {
+      const bool three = weight_type.size() > 3 && weight_type.compare(weight_type.size()-3, 3, "_3D") == 0;
+      point.assign(n, std::array<double,3>{{0, 0, 0}});
+      for (std::size_t i=0; i<n; i++) {
+        std::size_t id;
+        std::array<double,3> x{{0, 0, 0}};
+        if (!(in >> id >> x[0] >> x[1]) || (three && !(in >> x[2])) || id < 1 || id > n)
+          throw std::runtime_error(filename + ": bad NODE_COORD_SECTION");
+        point[id-1] = x;
+      }
+    }
+    else if (key == "EDGE_WEIGHT_SECTION") {
+      double w;
+      const std::size_t count = (weight_format == "FULL_MATRIX") ? n*n
+        : (weight_format.find("DIAG") != std::string::npos) ? n*(n+1)/2 : n*(n-1)/2;
+      while (weights.size() < count && in >> w) weights.push_back(w);
+      if (weights.size() < count) throw std::runtime_error(filename + ": short EDGE_WEIGHT_SECTION");
+    }
+    // Not needed: display coordinates (a line per node), and edge or
+    // tour lists (ended by -1)
+    else if (key == "DISPLAY_DATA_SECTION")
+      for (std::size_t i=0; i<n && std::getline(in, line); i++) { }
+    else if (key == "FIXED_EDGES_SECTION" || key == "TOUR_SECTION") {
+      std::string token;
+      while (in >> token && token != "-1") { }
+    }
+    else if (key == "EOF") break;
+  }
+
+  square_symmetric_matrix<T> dt(n);
+  if (weight_type == "EXPLICIT") {
+    if (weights.empty()) throw std::runtime_error(filename + ": no EDGE_WEIGHT_SECTION");
+    // The column formats list the same entries as the opposite row ones
+    std::string f = weight_format;
+    if (f == "UPPER_COL") f = "LOWER_ROW";
+    else if (f == "LOWER_COL") f = "UPPER_ROW";
+    else if (f == "UPPER_DIAG_COL") f = "LOWER_DIAG_ROW";
+    else if (f == "LOWER_DIAG_COL") f = "UPPER_DIAG_ROW";
+    std::size_t k = 0;
+    for (std::size_t i=0; i<n; i++) {
+      std::size_t first = 0, last = n;
+      if (f == "UPPER_ROW") first = i+1;
+      else if (f == "UPPER_DIAG_ROW") first = i;
+      else if (f == "LOWER_ROW") last = i;
+      else if (f == "LOWER_DIAG_ROW") last = i+1;
+      else if (f != "FULL_MATRIX")
+        throw std::runtime_error(filename + ": unsupported EDGE_WEIGHT_FORMAT " + weight_format);
+      for (std::size_t j=first; j<last; j++, k++)
+        if (i != j) dt.set(i, j, static_cast<T>(weights[k]));
+    }
+  }
+  else {
+    if (point.empty()) throw std::runtime_error(filename + ": no NODE_COORD_SECTION");
+    for (std::size_t p=0; p<n; p++)
+      for (std::size_t q=p+1; q<n; q++)
+        dt.set(p, q, static_cast<T>(tsplib_distance(weight_type, point[p], point[q])));
+  }
+  return Euclidean_set<T>(dt);
+}
+
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef LK_IMPL_HH
+#define LK_IMPL_HH
+
+// Heuristic engine for graphs of thousands of nodes, far beyond the
+// exact search: nearest-neighbour paths improved by Lin-Kernighan style
+// chains of 2-opt moves and by Or-opt, both looking only at the nearest
+// few nodes of every node, from independent randomised starts spread
+// over the threads.
+//
+// The tour is an array with the position of every node, so the
+// neighbours of a node are found in constant time. Paths become tours
+// through a dummy node at distance zero from every node, as in
+// local_search_cycle; for paths starting at node 0, the edge between the
+// dummy and node 0 is never removed. Every move is a sequence of 2-opt
+// moves, each reversing the shorter side of the tour. Nodes whose
+// surroundings did not change since no move was found from them are
+// skipped (don't-look bits).
+#include "path.hh"
+#include "candidate_impl.hh"
+#include <omp.h>
+#include <cstddef>
+#include <cmath>
+#include <deque>
+#include <vector>
+#include <random>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <algorithm>
+
+// Candidate list length when none is given
+constexpr std::size_t lk_candidates = 10;
+
+// Longest chain of 2-opt moves in one Lin-Kernighan step
+constexpr std::size_t lk_depth = 6;
+
+template <typename G>
+class lk_tour {
+public:
+  typedef std::size_t size_type;
+  typedef size_type index_type;
+  typedef typename G::value_type value_type;
+  typedef candidate_lists<G> candidates_type;
+
+  // An empty tour through g, with the candidate lists c (which must
+  // outlive it)
+  lk_tour(const G &g, const candidates_type &c, path_mode m) :
+    mygraph(g), cand(c), mode(m), n(g.size()), dummy(g.size()),
+    nt(g.size() + ((m == closed_tour) ? 0 : 1)), tour(nt), pos(nt), active(nt, 0),
+    queue(), chain(), added() { }
+
+  // Nearest-neighbour tour from start along the candidate lists (or
+  // the nearest unvisited node, once they are used up). With a
+  // generator, each step picks among the three nearest on the list.
+  template <typename R>
+  void construct(index_type start, R *rng) {
+    std::vector<char> visited(n, 0);
+    index_type k = 0;
+    if (mode != closed_tour) tour[k++] = dummy;
+    index_type cur = start;
+    visited[cur] = 1;
+    tour[k++] = cur;
+    for (index_type i=1; i<n; i++) {
+      index_type pick[3], npick = 0;
+      for (typename candidates_type::const_iterator it=cand.begin(cur); it != cand.end(cur) && npick < 3; ++it)
+        if (!visited[*it]) pick[npick++] = *it;
+      index_type next = n;
+      if (npick == 0) {
+        value_type best = std::numeric_limits<value_type>::max();
+        for (index_type j=0; j<n; j++)
+          if (!visited[j] && (next == n || mygraph.distance(cur, j) < best))
+            { next = j; best = mygraph.distance(cur, j); }
+      }
+      else next = rng ? pick[std::uniform_int_distribution<index_type>(0, npick-1)(*rng)] : pick[0];
+      visited[next] = 1;
+      tour[k++] = next;
+      cur = next;
+    }
+    for (index_type i=0; i<nt; i++) pos[tour[i]] = i;
+  }
+
+  // Apply moves until none improves the tour
+  void optimise() {
+    for (index_type i=0; i<nt; i++) activate(tour[i]);
+    while (!queue.empty()) {
+      const index_type t = queue.front();
+      queue.pop_front();
+      active[t] = 0;
+      if (t == dummy) continue;
+      if (lk_step(t) || or_step(t)) activate(t);
+    }
+  }
+
+  value_type weight() const {
+    value_type w = value_type();
+    for (index_type i=0; i<nt; i++) w += dist(tour[i], tour[(i+1 == nt) ? 0 : i+1]);
+    return w;
+  }
+
+  // The path (or tour) in its searched orientation, as in
+  // local_search_cycle
+  std::vector<std::size_t> order() const {
+    std::vector<std::size_t> o;
+    o.reserve(n);
+    for (index_type a=(mode == closed_tour) ? 0 : succ(dummy); o.size() < n; a=succ(a)) o.push_back(a);
+    if (mode == fixed_start && o.front() != 0) std::reverse(o.begin(), o.end());
+    if (mode == free_start && o.size() > 1 && o.back() < o.front())
+      std::reverse(o.begin(), o.end());
+    if (mode == closed_tour) {
+      std::rotate(o.begin(), std::find(o.begin(), o.end(), 0), o.end());
+      if (o.size() > 2 && o.back() < o[1]) std::reverse(o.begin()+1, o.end());
+    }
+    return o;
+  }
+
+private:
+  index_type succ(index_type a) const { const index_type i = pos[a] + 1; return tour[(i == nt) ? 0 : i]; }
+  index_type pred(index_type a) const { const index_type i = pos[a]; return tour[(i == 0) ? nt-1 : i-1]; }
+
+  value_type dist(index_type a, index_type b) const
+  { return (a == dummy || b == dummy) ? value_type() : mygraph.distance(a, b); }
+
+  // Nodes to try next to a: the dummy first (for paths), at distance
+  // zero, then its candidate list
+  size_type candidates() const { return cand.size() + ((mode == closed_tour) ? 0 : 1); }
+  index_type candidate(index_type a, size_type k) const {
+    if (mode != closed_tour && k-- == 0) return dummy;
+    return cand.begin(a)[k];
+  }
+
+  // The edge a path starting at node 0 keeps
+  bool fixed_edge(index_type a, index_type b) const
+  { return mode == fixed_start && ((a == dummy && b == 0) || (a == 0 && b == dummy)); }
+
+  // Gains below rounding noise are ignored so the search ends; scale
+  // is the weight of the edges a move removes
+  static bool gains(value_type gain, value_type scale)
+  { return gain > 4 * std::numeric_limits<value_type>::epsilon() * std::abs(scale); }
+
+  void activate(index_type a) {
+    if (active[a]) return;
+    active[a] = 1;
+    queue.push_back(a);
+  }
+
+  // Reverse the tour from a forward to b
+  void reverse(index_type a, index_type b) {
+    index_type i = pos[a], j = pos[b];
+    const index_type len = ((j >= i) ? j - i : j + nt - i) + 1;
+    for (index_type s=0; s<len/2; s++) {
+      const index_type x = tour[i], y = tour[j];
+      tour[i] = y; pos[y] = i;
+      tour[j] = x; pos[x] = j;
+      i = (i+1 == nt) ? 0 : i+1;
+      j = (j == 0) ? nt-1 : j-1;
+    }
+  }
+
+  // Remove the edges (a, b) and (c, d), which run the same way round the
+  // tour, and add (a, c) and (b, d)
+  void move(index_type a, index_type b, index_type c, index_type d) {
+    if (succ(a) != b) { std::swap(a, b); std::swap(c, d); }
+    // Now b follows a and d follows c: reverse b..c or d..a
+    const index_type inner = ((pos[c] >= pos[b]) ? pos[c] - pos[b] : pos[c] + nt - pos[b]) + 1;
+    if (2 * inner <= nt) reverse(b, c);
+    else reverse(d, a);
+  }
+
+  bool was_added(index_type a, index_type b) const {
+    for (const std::pair<index_type,index_type> &e : added)
+      if ((e.first == a && e.second == b) || (e.first == b && e.second == a)) return true;
+    return false;
+  }
+
+  // Lin-Kernighan step from t1: remove the edge to one of its
+  // neighbours t2, then repeatedly add the edge from t2 to a candidate t3
+  // and remove the edge from t3 to the neighbour t4 that closes a tour,
+  // which is a 2-opt move. t4 becomes the next t2. Each step takes the
+  // t3 that closes the lightest tour if that is lighter than before, and
+  // otherwise goes on with the t3 that gains most, while removed edges
+  // outweigh added ones, for up to lk_depth moves, which are then
+  // undone. Added edges are not removed again.
+  bool lk_step(index_type t1) {
+    for (int side=0; side<2; side++) {
+      index_type t2 = side ? pred(t1) : succ(t1);
+      if (fixed_edge(t1, t2)) continue;
+      value_type gain = dist(t1, t2), removed = gain;
+      chain.clear();
+      added.clear();
+      for (size_type depth=0; depth<lk_depth && t2 != dummy; depth++) {
+        const bool forward = (succ(t1) == t2);
+        index_type open3 = nt, open4 = nt, close3 = nt, close4 = nt;
+        value_type open = value_type(), close = value_type();
+        for (size_type k=0; k<candidates(); k++) {
+          const index_type t3 = candidate(t2, k);
+          const value_type g1 = gain - dist(t2, t3);
+          if (!(g1 > value_type())) break;
+          if (t3 == t1 || t3 == t2) continue;
+          const index_type t4 = forward ? pred(t3) : succ(t3);
+          if (t4 == t2 || t4 == t1 || fixed_edge(t3, t4) || was_added(t3, t4)) continue;
+          const value_type g2 = g1 + dist(t3, t4);
+          if (open3 == nt || g2 > open) { open = g2; open3 = t3; open4 = t4; }
+          if (close3 == nt || g2 - dist(t4, t1) > close) { close = g2 - dist(t4, t1); close3 = t3; close4 = t4; }
+        }
+        if (open3 == nt) break;
+        const bool closes = gains(close, removed + dist(close3, close4));
+        const index_type t3 = closes ? close3 : open3, t4 = closes ? close4 : open4;
+        move(t1, t2, t4, t3);
+        chain.push_back(std::make_pair(t2, std::make_pair(t4, t3)));
+        added.push_back(std::make_pair(t2, t3));
+        removed += dist(t3, t4);
+        if (closes) {
+          activate(t1);
+          for (const auto &m : chain) { activate(m.first); activate(m.second.first); activate(m.second.second); }
+          return true;
+        }
+        gain = open;
+        t2 = t4;
+      }
+      // Undo: each move took out (t1, t2) and (t4, t3) for (t1, t4) and
+      // (t2, t3)
+      for (size_type k=chain.size(); k-->0; )
+        move(t1, chain[k].second.first, chain[k].first, chain[k].second.second);
+    }
+    return false;
+  }
+
+  // Or-opt: move a segment of up to three nodes starting or ending at s
+  // between two neighbouring nodes c and d, one of them near an end of
+  // the segment, possibly reversed
+  bool or_step(index_type s) {
+    for (size_type len=1; len<=3 && len+3 <= nt; len++)
+      for (int side=0; side<2; side++) {
+        index_type seg[3];
+        index_type s1 = s;
+        if (side) for (size_type k=1; k<len; k++) s1 = pred(s1);
+        seg[0] = s1;
+        for (size_type k=1; k<len; k++) seg[k] = succ(seg[k-1]);
+        const index_type s2 = seg[len-1];
+        if (std::find(seg, seg+len, dummy) != seg+len) continue;
+        const index_type p = pred(s1), nx = succ(s2);
+        if (fixed_edge(p, s1) || fixed_edge(s2, nx)) continue;
+        const value_type cut = dist(p, s1) + dist(s2, nx);
+        const value_type saved = cut - dist(p, nx);
+        if (!(saved > value_type())) continue;
+        for (int end=0; end<2; end++) {
+          const index_type e = end ? s2 : s1;
+          for (size_type k=0; k<candidates(); k++) {
+            const index_type x = candidate(e, k);
+            if (!(dist(e, x) < saved)) break;
+            for (int after=0; after<2; after++) {
+              const index_type c = after ? x : pred(x), d = after ? succ(x) : x;
+              if (std::find(seg, seg+len, c) != seg+len || std::find(seg, seg+len, d) != seg+len) continue;
+              if (d == p || fixed_edge(c, d)) continue;
+              const value_type ahead = dist(c, s1) + dist(s2, d), back = dist(c, s2) + dist(s1, d);
+              const value_type cost = std::min(ahead, back) - dist(c, d);
+              if (!gains(saved - cost, cut + dist(c, d))) continue;
+              // p s1..s2 nx .. c d  ->  p c .. nx s2..s1 d  ->  p nx .. c s2..s1 d
+              move(p, s1, c, d);
+              if (c != nx) move(p, c, nx, s2);
+              if (len > 1 && ahead < back) move(c, s2, s1, d);
+              activate(p); activate(nx); activate(c); activate(d); activate(s1); activate(s2);
+              return true;
+            }
+          }
+        }
+      }
+    return false;
+  }
+
+  const G &mygraph;
+  const candidates_type &cand;
+  path_mode mode;
+  // Nodes, the dummy and the tour length (nodes and dummy if any)
+  index_type n, dummy, nt;
+  // tour[pos[a]] = a
+  std::vector<index_type> tour, pos;
+  // Nodes waiting in queue for a look
+  std::vector<char> active;
+  std::deque<index_type> queue;
+  // Moves of the current Lin-Kernighan chain (t2, (t4, t3)), and the
+  // edges it added
+  std::vector< std::pair<index_type, std::pair<index_type,index_type> > > chain;
+  std::vector< std::pair<index_type,index_type> > added;
+};
+
+// Best of `restarts` (at least one) optimised nearest-neighbour paths
+// along lists of the k nearest nodes (0: lk_candidates). The first
+// starts from node 0 and always takes the nearest node, the others pick
+// among the nearest three from random starts (node 0 for fixed paths).
+// Restarts are spread over the OpenMP threads; ties go to the lowest.
+// None but the first starts at or after deadline (omp_get_wtime(); 0:
+// none).
+template <typename G>
+std::vector<std::size_t> lk_order(const G &g, std::size_t restarts, std::size_t k,
+                                  path_mode mode=fixed_start, double deadline=0) {
+  typedef std::size_t index_type;
+  typedef typename G::value_type value_type;
+  const std::size_t n = g.size();
+  if (n < 3) {
+    std::vector<index_type> o(n);
+    std::iota(o.begin(), o.end(), 0);
+    return o;
+  }
+  const candidate_lists<G> cand(g, (k == 0) ? lk_candidates : k);
+  std::vector<index_type> best;
+  value_type best_weight = std::numeric_limits<value_type>::max();
+  index_type best_r = restarts;
+
+#pragma omp parallel for schedule(dynamic) default(shared)
+  for (index_type r=0; r<std::max<index_type>(restarts, 1); r++) {
+    if (r > 0 && deadline > 0 && omp_get_wtime() >= deadline) continue;
+    std::mt19937 rng(r);
+    const index_type start = (mode == fixed_start || r == 0) ? 0
+      : std::uniform_int_distribution<index_type>(0, n-1)(rng);
+    lk_tour<G> tour(g, cand, mode);
+    tour.construct(start, (r == 0) ? nullptr : &rng);
+    tour.optimise();
+    const value_type w = tour.weight();
+#pragma omp critical (lk_order)
+    if (w < best_weight || (w == best_weight && r < best_r))
+      { best_weight = w; best_r = r; best = tour.order(); }
+  }
+  return best;
+}
+
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef MATRIXFILE_IMPL_HH
+#define MATRIXFILE_IMPL_HH
+
+// Binary distance matrix files, memory-mapped read-only. A file is a
+// 64-byte header followed by the upper triangle of the matrix row by
+// row (packed_layout), in host byte order:
+//
+//   offset  0  char[8]   magic "H4MATRIX"
+//           8  uint32    version (1)
+//          12  uint32    bytes per value (sizeof(T))
+//          16  uint64    number of nodes n
+//          24  uint64    offset of the matrix (64)
+//          32            zero up to 64
+//          64  T[n(n+1)/2]
+//
+// The mapped matrix points straight into the page cache, so loading
+// takes no parsing and no copy, and processes on one host share it.
+#include "square_symmetric_matrix.hh"
+#include "Euclidean_impl.hh"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <stdexcept>
+
+struct matrix_file_header {
+  char magic[8];
+  std::uint32_t version, value_size;
+  std::uint64_t n, offset;
+  char pad[32];
+};
+
+static_assert(sizeof(matrix_file_header) == 64, "matrix_file_header must take 64 bytes");
+
+// A whole file mapped read-only; unmapped with the last reference
+class mapped_file {
+public:
+  explicit mapped_file(const std::string &filename) : addr(nullptr), length(0) {
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open " + filename);
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); throw std::runtime_error("Cannot stat " + filename); }
+    length = static_cast<std::size_t>(st.st_size);
+    if (length > 0) addr = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) throw std::runtime_error("Cannot map " + filename);
+  }
+
+  ~mapped_file() { if (addr && addr != MAP_FAILED) munmap(addr, length); }
+
+  const char* data() const { return static_cast<const char*>(addr); }
+  std::size_t size() const { return length; }
+
+private:
+  mapped_file(const mapped_file &) = delete;
+  mapped_file& operator=(const mapped_file &) = delete;
+
+  void *addr;
+  std::size_t length;
+};
+
+// Read-only array over part of a mapped file, usable as the container
+// of a square_symmetric_matrix. Copies share the mapping.
+template <typename T>
+class mapped_array {
+public:
+  typedef T value_type;
+  typedef std::size_t size_type;
+
+  mapped_array(std::shared_ptr<const mapped_file> f, size_type offset, size_type m) :
+    file(f), first(reinterpret_cast<const T*>(f->data() + offset)), count(m) { }
+
+  size_type size() const { return count; }
+  const T& operator[](size_type i) const { return first[i]; }
+
+private:
+  std::shared_ptr<const mapped_file> file;
+  const T *first;
+  size_type count;
+};
+
+template <typename T>
+using mapped_symmetric_matrix = square_symmetric_matrix< T, mapped_array<T>, packed_layout >;
+
+// Graph over a mapped matrix file
+template <typename T=double>
+using mapped_Euclidean_set = Euclidean_set< T, mapped_symmetric_matrix<T> >;
+
+
+// True if the file starts with the matrix file magic
+inline bool is_matrix_file(const std::string &filename) {
+  char magic[8] = { 0 };
+  std::ifstream in(filename.c_str(), std::ios::binary);
+  return in.read(magic, sizeof(magic)) && std::memcmp(magic, "H4MATRIX", 8) == 0;
+}
+
+// Write the distances of graph g as a matrix file
+template <typename T, typename G>
+void write_matrix_file(const std::string &filename, const G &g) {
+  matrix_file_header h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, "H4MATRIX", 8);
+  h.version = 1;
+  h.value_size = sizeof(T);
+  h.n = g.size();
+  h.offset = sizeof(h);
+
+  std::ofstream out(filename.c_str(), std::ios::binary);
+  if (!out) throw std::runtime_error("Cannot create " + filename);
+  out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+  std::vector<T> row(g.size());
+  for (std::size_t i=0; i<g.size(); i++) {
+    for (std::size_t j=i; j<g.size(); j++) row[j-i] = static_cast<T>(g.distance(i, j));
+    out.write(reinterpret_cast<const char*>(row.data()), (g.size() - i) * sizeof(T));
+  }
+  if (!out) throw std::runtime_error("Cannot write " + filename);
+}
+
+// Map a matrix file written with the same T
+template <typename T=double>
+mapped_Euclidean_set<T> map_matrix_file(const std::string &filename) {
+  std::shared_ptr<const mapped_file> f(new mapped_file(filename));
+  matrix_file_header h;
+  if (f->size() < sizeof(h)) throw std::runtime_error(filename + ": not a matrix file");
+  std::memcpy(&h, f->data(), sizeof(h));
+  if (std::memcmp(h.magic, "H4MATRIX", 8) != 0 || h.version != 1)
+    throw std::runtime_error(filename + ": not a matrix file");
+  if (h.value_size != sizeof(T))
+    throw std::runtime_error(filename + ": stored values have the wrong size");
+  // The header is not trusted: n is bounded before n*(n+1)/2 is taken,
+  // and nothing is added to the offset, so neither can wrap around
+  if (h.offset % alignof(T) != 0 || h.offset > f->size() || h.n >= (std::uint64_t(1) << 32))
+    throw std::runtime_error(filename + ": bad matrix file header");
+  const std::size_t n = h.n, entries = packed_layout(n, sizeof(T)).size();
+  if (entries > (f->size() - h.offset) / sizeof(T))
+    throw std::runtime_error(filename + ": truncated matrix file");
+  return mapped_Euclidean_set<T>(mapped_symmetric_matrix<T>(n, mapped_array<T>(f, h.offset, entries)));
+}
+
+
+#endif
@@ -5,8 +5,18 @@
 #include <iostream>
 #include <deque>
 
-template < typename T=double, typename Container=std::deque<std::size_t> >
-class path {
+// Which paths through all nodes are searched: open paths from a fixed
+// first node, open paths from any node, or closed tours (which return
+// to the first node; the return edge counts towards the weight)
+enum path_mode { fixed_start, free_start, closed_tour };
+
+// Static interface of a path: path type D derives from basic_path<D>
+// and provides size(), weight(), begin(), rbegin(), end(), rend(),
+// push_back() and pop_back() as documented in path below, plus (for
+// path_adapter) the private num_neighbor() and neighbor(i). path<T,C>
+// is the same interface with virtual functions, for type erasure.
+template < typename D, typename T=double, typename Container=std::deque<std::size_t> >
+class basic_path {
 public:
   typedef std::size_t size_type;
   typedef size_type index_type;
@@ -15,6 +25,23 @@ public:
   typedef typename container_type::const_iterator const_iterator;
   typedef typename container_type::const_reverse_iterator const_reverse_iterator;
 
+  const D& derived() const { return static_cast<const D&>(*this); }
+
+protected:
+  ~basic_path() { }
+};
+
+template < typename T=double, typename Container=std::deque<std::size_t> >
+class path : public basic_path<path<T,Container>, T, Container> {
+public:
+  typedef basic_path<path<T,Container>, T, Container> base_type;
+  typedef typename base_type::size_type size_type;
+  typedef typename base_type::index_type index_type;
+  typedef typename base_type::value_type value_type;
+  typedef typename base_type::container_type container_type;
+  typedef typename base_type::const_iterator const_iterator;
+  typedef typename base_type::const_reverse_iterator const_reverse_iterator;
+
   // "Size" of the path (number of nodes)
   virtual size_type size() const = 0;
 
@@ -39,23 +66,55 @@ private:
   virtual index_type neighbor(index_type i) const = 0;
 };
 
+// A path of static type P behind the virtual interface. P has to be a
+// friend of the adapter (for num_neighbor and neighbor) and outlive it.
+template <typename P>
+class path_adapter : public path<typename P::value_type, typename P::container_type> {
+public:
+  typedef path<typename P::value_type, typename P::container_type> base_type;
+  typedef typename base_type::size_type size_type;
+  typedef typename base_type::index_type index_type;
+  typedef typename base_type::value_type value_type;
+  typedef typename base_type::const_iterator const_iterator;
+  typedef typename base_type::const_reverse_iterator const_reverse_iterator;
+
+  explicit path_adapter(P &p) : mypath(p) { }
+
+  size_type size() const { return mypath.size(); }
+  value_type weight() const { return mypath.weight(); }
+
+  const_iterator begin() const { return mypath.begin(); }
+  const_reverse_iterator rbegin() const { return mypath.rbegin(); }
+  const_iterator end() const { return mypath.end(); }
+  const_reverse_iterator rend() const { return mypath.rend(); }
+
+  void push_back(index_type i) { mypath.push_back(i); }
+  void pop_back() { mypath.pop_back(); }
+
+private:
+  size_type num_neighbor() const { return mypath.num_neighbor(); }
+  index_type neighbor(index_type i) const { return mypath.neighbor(i); }
+
+  P &mypath;
+};
+
 // Comparison operators for paths (compare the weights)
-template <typename T, typename C1, typename C2>
-bool operator<(const path<T,C1> &p1, const path<T,C2> &p2)
-{ return p1.weight() < p2.weight(); }
+template <typename D1, typename D2, typename T, typename C1, typename C2>
+bool operator<(const basic_path<D1,T,C1> &p1, const basic_path<D2,T,C2> &p2)
+{ return p1.derived().weight() < p2.derived().weight(); }
 
-template <typename T, typename C1, typename C2>
-bool operator>(const path<T,C1> &p1, const path<T,C2> &p2)
-{ return p1.weight() > p2.weight(); }
+template <typename D1, typename D2, typename T, typename C1, typename C2>
+bool operator>(const basic_path<D1,T,C1> &p1, const basic_path<D2,T,C2> &p2)
+{ return p1.derived().weight() > p2.derived().weight(); }
 
 // Print path
-template <typename V, typename C>
-std::ostream& operator<<(std::ostream& os, const path<V,C> &p) {
-  typedef typename path<V,C>::const_iterator path_iterator;
+template <typename D, typename V, typename C>
+std::ostream& operator<<(std::ostream& os, const basic_path<D,V,C> &p) {
+  typedef typename basic_path<D,V,C>::const_iterator path_iterator;
   os << "path: ";
-  for (path_iterator it=p.begin(); it != p.end(); ++it)
+  for (path_iterator it=p.derived().begin(); it != p.derived().end(); ++it)
     os << (*it) << " ";
-  os << "weight: " << p.weight();
+  os << "weight: " << p.derived().weight();
   return os;
 }
 
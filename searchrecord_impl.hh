@@ -0,0 +1,118 @@
+#ifndef SEARCHRECORD_IMPL_HH
+#define SEARCHRECORD_IMPL_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <new>
+#include <algorithm>
+
+// Compact search task: the decided prefix of a search path, its weight
+// and a lower bound on any completion (for best-first selection). The
+// task is the subtree below the prefix, or only the children from
+// first_child() on if work was donated: the children of a prefix are
+// enumerated in an order fixed by the prefix alone. The nodes are stored
+// inline right after the header, so a record takes one pool block
+// proportional to the depth it was split at.
+template <typename T>
+class search_record {
+public:
+  typedef T value_type;
+  typedef std::size_t size_type;
+  typedef std::uint32_t node_type;
+  typedef const node_type* const_iterator;
+
+  template <typename R> friend class record_pool;
+
+  size_type size() const { return length; }
+  value_type weight() const { return total_distance; }
+  value_type bound() const { return lower_bound; }
+  size_type first_child() const { return start; }
+
+  const_iterator begin() const { return nodes(); }
+  const_iterator end() const { return nodes() + length; }
+
+  // Fill the record; the pool sized it for exactly [first, last). The
+  // bound defaults to the weight, and the task to the whole subtree.
+  template <typename InputIt>
+  void assign(InputIt first, InputIt last, value_type w) {
+    std::copy(first, last, nodes());
+    total_distance = lower_bound = w;
+    start = 0;
+  }
+
+  void set_bound(value_type b) { lower_bound = b; }
+  void set_first_child(size_type c) { start = c; }
+
+  // Bytes taken by a record with m nodes, rounded up to keep headers aligned
+  static size_type block_size(size_type m) {
+    const size_type a = alignof(search_record);
+    return (sizeof(search_record) + m*sizeof(node_type) + a - 1) / a * a;
+  }
+
+private:
+  search_record(size_type m) :
+    total_distance(value_type()), lower_bound(value_type()), length(m), start(0), next(nullptr) { }
+
+  node_type* nodes() { return reinterpret_cast<node_type*>(this + 1); }
+  const node_type* nodes() const { return reinterpret_cast<const node_type*>(this + 1); }
+
+  value_type total_distance, lower_bound;
+  size_type length, start;
+  search_record *next; // free list link
+};
+
+
+// Single-threaded pool of search records, with one free list per prefix
+// length carved out of large chunks. Every thread uses its own pool.
+// Records may be released into a different pool than the one they came
+// from, so all pools must outlive every record (keep them together
+// until the search is over).
+template <typename R>
+class record_pool {
+public:
+  typedef R record_type;
+  typedef typename record_type::size_type size_type;
+
+  record_pool(size_type chunk_bytes = size_type(1) << 16) :
+    chunk_size(chunk_bytes), free_list(), chunks(), cursor(nullptr), left(0) { }
+
+  record_type* allocate(size_type m) {
+    if (m >= free_list.size()) free_list.resize(m+1, nullptr);
+    record_type *r = free_list[m];
+    if (r) { free_list[m] = r->next; r->next = nullptr; return r; }
+
+    const size_type bytes = record_type::block_size(m);
+    if (bytes > left) {
+      const size_type size = std::max(chunk_size, bytes);
+      chunks.emplace_back(new char[size]);
+      cursor = chunks.back().get();
+      left = size;
+    }
+    r = new (cursor) record_type(m);
+    cursor += bytes;
+    left -= bytes;
+    return r;
+  }
+
+  void release(record_type *r) {
+    const size_type m = r->size();
+    if (m >= free_list.size()) free_list.resize(m+1, nullptr);
+    r->next = free_list[m];
+    free_list[m] = r;
+  }
+
+private:
+  record_pool(const record_pool &) = delete;
+  record_pool& operator=(const record_pool &) = delete;
+
+  size_type chunk_size;
+  std::vector<record_type*> free_list;
+  std::vector< std::unique_ptr<char[]> > chunks;
+  char *cursor;
+  size_type left;
+};
+
+
+#endif
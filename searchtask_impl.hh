@@ -2,79 +2,250 @@
 #define SEARCHTASK_IMPL_HH
 
 #include <omp.h>
-#include <queue>
+#include <ostream>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <atomic>
 #include <functional>
+#include <limits>
 
-// Search task queue -- any call to this must 
 #include "task.hh"
+#include "stats_impl.hh"
+
+// Node selection policies: the order in which tasks are handed out
+//   lifo_select:   the owner takes its newest task (depth first), thieves
+//                  the oldest, which are the largest subtrees
+//   fifo_select:   everybody takes the oldest task (breadth first)
+//   best_select:   everybody takes the task with the lowest bound, over
+//                  all queues
+//   hybrid_select: the owner dives into the task it split off last;
+//                  everything older is shared best first
+enum select_policy { lifo_select, fifo_select, best_select, hybrid_select };
+
+// Priority of a task for best-first selection; lower is better
+template <typename R>
+double task_key(const R *t) { return static_cast<double>(t->bound()); }
+
+// Search task queue -- one per thread. For the best-first policies the
+// container is a heap on task_key(), and the lowest key is published so
+// that takers can pick a queue without locking it.
+template <typename T, typename A> class search_manager;
+
 template <typename T>
-class search_queue : public task_queue<T> {
+class search_queue : public basic_task_queue<search_queue<T>, T> {
 public:
-  // typedef std::queue<T> container_type;
-  typedef std::stack<T> container_type;
-  typedef task_queue<T> base_type;
+  typedef std::deque<T> container_type;
+  typedef basic_task_queue<search_queue<T>, T> base_type;
   typedef typename base_type::task_type task_type;
   typedef typename base_type::size_type size_type;
 
   template <typename V, typename A> friend class search_manager;
+  template <typename V, typename W> friend
+  std::ostream& operator<<(std::ostream &os, search_manager<V,W> &manager);
 
-  search_queue() : container() { omp_init_lock(&lock); }
+  search_queue(select_policy s=lifo_select) :
+    select(s), container(), newest(), has_newest(false), count(0),
+    top(std::numeric_limits<double>::infinity()), counters(nullptr) { omp_init_lock(&lock); }
 
-  void add(const task_type &t)
-  { get_lock(); container.push(t); release_lock(); }
+  void add(const task_type &t) {
+    get_lock();
+    if (select == hybrid_select) {
+      if (has_newest) push(newest);
+      newest = t;
+      has_newest = true;
+    }
+    else push(t);
+    update_count();
+    release_lock();
+  }
 
-  task_type get() {
+  // Owner end: the newest task (lifo), the oldest (fifo), the best
+  // (best) or the one split off last, if still there (hybrid)
+  bool get(task_type &t) {
+    if (size() == 0) return false;
     get_lock();
-    // task_type task = container.front();
-    task_type task = container.top();
-    container.pop();
+    bool found;
+    if (select == hybrid_select) {
+      found = has_newest;
+      if (found) { t = newest; has_newest = false; }
+    }
+    else {
+      found = !container.empty();
+      if (found) {
+        if (select == lifo_select) { t = container.back(); container.pop_back(); }
+        else pop_front(t);
+      }
+    }
+    update_count();
     release_lock();
-    return task;
+    return found;
   }
 
-  size_type size() { return container.size(); }
+  // Thief end: the oldest task, or the best for the best-first policies
+  bool steal(task_type &t) {
+    if (size() == 0) return false;
+    get_lock();
+    bool found = !container.empty();
+    if (found) pop_front(t);
+    else if (has_newest) { t = newest; has_newest = false; found = true; }
+    update_count();
+    release_lock();
+    return found;
+  }
+
+  // Lock-free hint; may be stale by the time the caller acts on it
+  size_type size() {
+    size_type c;
+#pragma omp atomic read
+    c = count;
+    return c;
+  }
+
+  // Lowest key in the queue (infinity if empty); a hint like size()
+  double top_key() {
+    double k;
+#pragma omp atomic read
+    k = top;
+    return k;
+  }
 
   ~search_queue() { omp_destroy_lock(&lock); }
 
 private:
-  void get_lock() { omp_set_lock(&lock); }
+  bool heap() const { return select == best_select || select == hybrid_select; }
+
+  // Heap order: the front is the task with the lowest key
+  static bool worse(const task_type &a, const task_type &b) { return task_key(a) > task_key(b); }
+
+  void push(const task_type &t) {
+    container.push_back(t);
+    if (heap()) std::push_heap(container.begin(), container.end(), worse);
+  }
+
+  void pop_front(task_type &t) {
+    if (heap()) {
+      std::pop_heap(container.begin(), container.end(), worse);
+      t = container.back();
+      container.pop_back();
+    }
+    else { t = container.front(); container.pop_front(); }
+  }
+
+  // Lock waits are charged to the calling thread's counters
+  void get_lock() {
+#ifdef SEARCH_STATS
+    if (counters) { timed_lock(&lock, (*counters)[omp_get_thread_num()]); return; }
+#endif
+    omp_set_lock(&lock);
+  }
   void release_lock() { omp_unset_lock(&lock); }
 
+  // Publish the size for size() and the best key for top_key(); called
+  // with the lock held
+  void update_count() {
+    const size_type c = container.size() + (has_newest ? 1 : 0);
+#pragma omp atomic write
+    count = c;
+    if (heap()) {
+      double k = std::numeric_limits<double>::infinity();
+      if (!container.empty()) k = task_key(container.front());
+      if (has_newest) k = std::min(k, task_key(newest));
+#pragma omp atomic write
+      top = k;
+    }
+  }
+
+  select_policy select;
   omp_lock_t lock;
   container_type container;
+  task_type newest; // hybrid only: the task the owner dives into next
+  bool has_newest;
+  size_type count;
+  double top;
+  counters_vector *counters;
 };
 
 
+// Work-stealing manager: every thread of the team owns a search_queue.
+// A task counts as outstanding from give() until finish(), so the search
+// is done exactly when the count drops to zero: a worker always gives
+// its split-off tasks before finishing its own. Tasks are handed out in
+// the order of the select_policy.
+//
+// For checkpoints, another thread can pause() the manager: get() then
+// hands out nothing, and workers give back what is left of their task
+// as soon as they see draining(). Once paused(), every outstanding task
+// is in a queue, where for_each_task() can look at it, until resume().
+// In a distributed search, the thread linked to the other processes
+// take()s queued tasks away and offer()s their answers.
 template <typename T, typename A>
-class search_manager : public task_manager<T,A> {
+class search_manager : public basic_task_manager<search_manager<T,A>, T, A> {
 public:
-  typedef task_manager<T,A> base_type;
+  typedef basic_task_manager<search_manager<T,A>, T, A> base_type;
   typedef search_queue<T> tqueue_type;
   typedef typename base_type::task_type task_type;
   typedef typename base_type::answer_type answer_type;
   typedef typename base_type::size_type size_type;
+  typedef typename base_type::value_type value_type;
+
+  // An answer that replaced the stored one, and when (omp_get_wtime())
+  struct incumbent {
+    double time;
+    value_type weight;
+  };
 
   template <typename V, typename W> friend
   std::ostream& operator<<(std::ostream &os, search_manager<V,W> &manager);
 
-  search_manager(const task_type &first_task, const answer_type& initial_answer) :
-    queue(), ntask(0), ans(initial_answer), alloc(false)
-  { omp_init_lock(&lock); give(first_task); }
+  search_manager(const task_type &first_task, const answer_type& initial_answer,
+                 select_policy s=lifo_select) :
+    select(s), queue(), worker(omp_get_max_threads()), ntask(0), nqueued(0),
+    watermark(worker.size() > 1 ? worker.size() : 0), grain(initial_grain),
+    team(0), parked(0), epoch(0), drain(false), stopped(false), checked(0), wanted(0),
+    best(initial_answer.weight()), keep(1), floor(std::numeric_limits<value_type>::lowest()),
+    ans(initial_answer), observer(),
+    history(1, incumbent{omp_get_wtime(), initial_answer.weight()}),
+    stats(worker.size()) {
+    omp_init_lock(&lock);
+    for (size_type i=0; i<worker.size(); i++) {
+      queue.emplace_back(new tqueue_type(select));
+      queue.back()->counters = &stats;
+      worker[i].rng = i + 1;
+    }
+    give(first_task);
+  }
 
-  task_type get() {
-#ifndef NDEBUG
-    if (!alloc) throw std::runtime_error("get(): alloc was not set");
-#endif
-    // The order of the following statements matters
-    task_type task = queue.get();
-    alloc = false;
-    return task;
+  bool get(task_type &task) {
+    const size_type me = thread();
+    if (drain.load(std::memory_order_seq_cst)) { park(me); return false; }
+    const bool best_first = (select == best_select || select == hybrid_select);
+    if (select != best_select && queue[me]->get(task)) return taken(me, me);
+    // Best first: the queue with the lowest published key
+    if (best_first) {
+      const size_type q = best_queue();
+      if (q < queue.size() && queue[q]->steal(task)) return taken(me, q);
+    }
+    // Steal, starting from a random victim so thieves spread out. Under
+    // best first the hint may have been stale, so the own queue counts.
+    const size_type nq = queue.size();
+    const size_type first = random(me) % nq;
+    for (size_type i=0; i<nq; i++) {
+      const size_type victim = (first + i) % nq;
+      if ((victim != me || best_first) && queue[victim]->steal(task)) return taken(me, victim);
+    }
+    return false;
   }
 
   void give(const task_type &task) {
-    queue.add(task);
 #pragma omp atomic update
     ntask++;
+#pragma omp atomic update
+    nqueued++;
+    queue[thread()]->add(task);
   }
 
   void finish(const task_type &task) {
@@ -83,58 +254,281 @@ public:
     ntask--;
   }
 
-  answer_type& conclude(const answer_type &a) {
-    if (a < ans) {
-      get_lock();
-      ans = a;
-      release_lock();
+  // Spin briefly, then yield, then sleep with growing intervals
+  void idle() {
+    const size_type me = thread();
+    const double start = search_counters::now();
+    size_type &b = worker[me].backoff;
+    if (b < spin_limit) {
+      for (volatile size_type i=0; i<(size_type(1) << b); i++) { }
     }
-    return ans;
+    else if (b < yield_limit) std::this_thread::yield();
+    else {
+      const size_type shift = std::min<size_type>(b - yield_limit, max_sleep_shift);
+      std::this_thread::sleep_for(std::chrono::microseconds(size_type(1) << shift));
+    }
+    b++;
+    stats[me].idled(search_counters::now() - start);
+  }
+
+  // The bound is lowered with a compare-and-swap; only the winner copies
+  // the path, under the lock. Winners can reach the lock out of order,
+  // so the stored path is only replaced by a lighter one.
+  bool conclude(const answer_type &a) { return improve(a, true); }
+
+  // An answer found elsewhere (another process), offered by a thread
+  // outside the team
+  bool offer(const answer_type &a) { return improve(a, false); }
+
+  // Demand for work: fewer tasks queued than there are threads, as when
+  // a thread has gone idle, or than want() asked for. Never with a single
+  // thread on its own.
+  bool hungry() const {
+    const size_type nq = queued();
+    return nq < watermark || nq < wanted.load(std::memory_order_relaxed);
+  }
+
+  // Keep k tasks queued, to take() them away (0: back to normal)
+  void want(size_type k) { wanted.store(k, std::memory_order_relaxed); }
+
+  // Tasks in the queues
+  size_type queued() const {
+    size_type nq;
+#pragma omp atomic read
+    nq = nqueued;
+    return nq;
   }
 
+  // Take a queued task out of the search, for another process; from a
+  // thread outside the team. The task no longer counts as outstanding.
+  bool take(task_type &task) {
+    for (size_type i=0; i<queue.size(); i++) {
+      tqueue_type &q = *queue[i];
+      if (q.size() == 0) continue;
+      omp_set_lock(&q.lock);
+      bool found = !q.container.empty();
+      if (found) q.pop_front(task);
+      else if (q.has_newest) { task = q.newest; q.has_newest = false; found = true; }
+      q.update_count();
+      omp_unset_lock(&q.lock);
+      if (!found) continue;
+#pragma omp atomic update
+      nqueued--;
+#pragma omp atomic update
+      ntask--;
+      return true;
+    }
+    return false;
+  }
+
+  // Smallest subtree worth splitting off, in open nodes
+  size_type split_grain() const { return grain.load(std::memory_order_relaxed); }
+
+  // Adapt the grain to how long a task took: a task much shorter than
+  // handing it out was not worth splitting off, while long tasks can be
+  // split finer. Concurrent updates may be lost, which is harmless.
+  void task_time(double seconds) {
+    const size_type g = split_grain();
+    if (seconds * 1e6 < short_task_us && g < max_grain)
+      grain.store(g + 1, std::memory_order_relaxed);
+    else if (seconds * 1e6 > long_task_us && g > min_grain)
+      grain.store(g - 1, std::memory_order_relaxed);
+  }
+
+  // Every thread of the team calls this once before taking tasks, and
+  // all of them before anything pause()s
+  void join() { team.fetch_add(1, std::memory_order_seq_cst); }
+
+  // Pausing for a checkpoint: see above
+  void pause() {
+    epoch.fetch_add(1, std::memory_order_relaxed);
+    drain.store(true, std::memory_order_seq_cst);
+  }
+  bool draining() const { return drain.load(std::memory_order_relaxed); }
+  bool paused() const
+  { return parked.load(std::memory_order_acquire) == team.load(std::memory_order_seq_cst); }
+  void resume() {
+    parked.store(0, std::memory_order_relaxed);
+    drain.store(false, std::memory_order_release);
+  }
+
+  // End a paused search early: done() from now on, with the tasks left
+  // in the queues
+  void halt() { stopped.store(true, std::memory_order_release); }
+  bool halted() const { return stopped.load(std::memory_order_acquire); }
+
+  // Call f on every queued task, under the queue locks. Only complete
+  // while paused.
+  template <typename F>
+  void for_each_task(F f) {
+    for (size_type i=0; i<queue.size(); i++) {
+      tqueue_type &q = *queue[i];
+      omp_set_lock(&q.lock);
+      for (typename tqueue_type::container_type::const_iterator it=q.container.begin();
+           it != q.container.end(); ++it)
+        f(*it);
+      if (q.has_newest) f(q.newest);
+      omp_unset_lock(&q.lock);
+    }
+  }
+
+  // A copy of the answer, safe to take while the workers run
+  answer_type answer_copy() {
+    omp_set_lock(&lock);
+    const answer_type a(ans);
+    omp_unset_lock(&lock);
+    return a;
+  }
+
+  // Search nodes checked by finished tasks
+  void add_nodes(size_type k) { checked.fetch_add(k, std::memory_order_relaxed); }
+  size_type nodes() const { return checked.load(std::memory_order_relaxed); }
+
   bool done() const {
     size_type nt;
-    // Seems to not be necessary here
-// #pragma omp atomic read
+#pragma omp atomic read
     nt = ntask;
-    return (ntask == 0);
+    return (nt == 0) || stopped.load(std::memory_order_relaxed);
   }
 
-  bool has_work() {
-    bool work;
-    get_lock();
-    if (!alloc) {
-      work = (queue.size() > 0);
-      if (work) alloc = true;
-    }
-    else work = false;
-    release_lock();
-    return work;
+  value_type bound() const { return best.load(std::memory_order_relaxed); }
+
+  // Prune what cannot beat the answer by more than a fraction gap of it:
+  // the answer is then within gap of the optimum
+  void relax(double gap) { keep = 1 - gap; }
+  value_type cutoff() const {
+    const value_type b = bound();
+    return (b <= floor) ? std::numeric_limits<value_type>::lowest() : b * keep;
   }
 
+  // No path is lighter than w: once the answer is that light, everything
+  // left is pruned
+  void settle(value_type w) { floor = w; }
+
+  // Call f on every answer stored, in order, under the lock (so it must
+  // be quick and must not throw)
+  void on_improve(const std::function<void(const answer_type&)> &f) { observer = f; }
+
+  // Only safe to read once the workers are done
   const answer_type& answer() const { return ans; }
 
+  // The calling thread's counters
+  search_counters& counters() { return stats[thread()]; }
+
+  // Everybody's, once the workers are done
+  const counters_vector& all_counters() const { return stats; }
+
+  // Every stored answer in turn, starting with the initial one. Only
+  // safe to read once the workers are done.
+  const std::vector<incumbent>& incumbents() const { return history; }
+
   ~search_manager() { omp_destroy_lock(&lock); }
 private:
-  void get_lock() { omp_set_lock(&lock); }
+  // Per-thread scheduling state, on its own cache line
+  struct alignas(64) worker_state {
+    worker_state() : rng(1), backoff(0), parked(0) { }
+    size_type rng, backoff, parked;
+  };
+
+  // Backoff stages, counted in consecutive failed get() calls
+  enum { spin_limit = 8, yield_limit = 16, max_sleep_shift = 8 };
+  // Split grain limits (open nodes) and target task durations
+  enum { initial_grain = 6, min_grain = 3, max_grain = 64 };
+  enum { short_task_us = 50, long_task_us = 5000 };
+
+  size_type thread() const { return omp_get_thread_num(); }
+
+  bool improve(const answer_type &a, bool counted) {
+    const value_type w = a.weight();
+    value_type current = bound();
+    while (w < current)
+      if (best.compare_exchange_weak(current, w, std::memory_order_relaxed)) {
+        if (counted) get_lock();
+        else omp_set_lock(&lock);
+        if (w < ans.weight()) {
+          ans = a;
+          history.push_back(incumbent{omp_get_wtime(), w});
+          if (search_counters::enabled && counted) counters().improved(history.back().time, w);
+          if (observer) observer(ans);
+        }
+        release_lock();
+        return true;
+      }
+    return false;
+  }
+
+  // Thread me took a task from queue q
+  bool taken(size_type me, size_type q) {
+#pragma omp atomic update
+    nqueued--;
+    worker[me].backoff = 0;
+    stats[me].task_taken(q != me);
+    return true;
+  }
+
+  // Thread me holds no task while the manager is paused; counted once
+  // per pause
+  void park(size_type me) {
+    const size_type e = epoch.load(std::memory_order_relaxed);
+    if (worker[me].parked == e) return;
+    worker[me].parked = e;
+    parked.fetch_add(1, std::memory_order_acq_rel);
+  }
+
+  // Queue with the lowest published key, or queue.size() if all are empty
+  size_type best_queue() {
+    size_type q = queue.size();
+    double k = std::numeric_limits<double>::infinity();
+    for (size_type i=0; i<queue.size(); i++) {
+      if (queue[i]->size() == 0) continue;
+      const double ki = queue[i]->top_key();
+      if (q == queue.size() || ki < k) { q = i; k = ki; }
+    }
+    return q;
+  }
+
+  // xorshift; cheap and good enough to pick victims
+  size_type random(size_type me) {
+    size_type &x = worker[me].rng;
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+    return x;
+  }
+
+  void get_lock() {
+    if (search_counters::enabled) timed_lock(&lock, counters());
+    else omp_set_lock(&lock);
+  }
   void release_lock() { omp_unset_lock(&lock); }
 
-  tqueue_type queue;
-  size_type ntask;
+  select_policy select;
+  std::vector< std::unique_ptr<tqueue_type> > queue;
+  std::vector< worker_state, aligned_allocator<worker_state> > worker;
+  size_type ntask, nqueued, watermark;
+  std::atomic<size_type> grain, team, parked, epoch;
+  std::atomic<bool> drain, stopped;
+  std::atomic<size_type> checked, wanted;
+  std::atomic<value_type> best;
+  double keep;
+  value_type floor;
   answer_type ans;
+  std::function<void(const answer_type&)> observer;
+  std::vector<incumbent> history;
+  counters_vector stats;
   omp_lock_t lock;
-  bool alloc;
 };
 
 
 template <typename V, typename W>
 std::ostream& operator<<(std::ostream &os, search_manager<V,W> &manager) {
   typedef typename search_manager<V,W>::tqueue_type queue_type;
-  typedef typename queue_type::const_iterator const_iterator;
-  queue_type &q = manager.queue;
-  for (const_iterator it=q.begin(); it != q.end()-1; ++it)
-    os << *it << " ";
-  os << *(q.end()-1);
+  typedef typename queue_type::container_type::const_iterator const_iterator;
+  for (std::size_t i=0; i<manager.queue.size(); i++) {
+    queue_type &q = *manager.queue[i];
+    os << "queue " << i << ":";
+    for (const_iterator it=q.container.begin(); it != q.container.end(); ++it)
+      os << " " << *it;
+    os << std::endl;
+  }
   return os;
 }
 
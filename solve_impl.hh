@@ -0,0 +1,890 @@
+#ifndef SOLVE_IMPL_HH
+#define SOLVE_IMPL_HH
+
+// The solver shared by h4 and the benchmarks: options, engine choice
+// and the parallel branch-and-bound search. It works on any graph type
+// with size() and distance(i, j), such as the Euclidean_set variants.
+#include <omp.h>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <memory>
+#include <numeric>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <exception>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "square_symmetric_matrix.hh"
+#include "Euclidean_impl.hh"
+#include "searchtask_impl.hh"
+#include "bound_impl.hh"
+#include "heuristic_impl.hh"
+#include "heldkarp_impl.hh"
+#include "lk_impl.hh"
+#include "candidate_impl.hh"
+#include "fixed_impl.hh"
+#include "dominance_impl.hh"
+#include "checkpoint_impl.hh"
+#include "distributed_impl.hh"
+
+typedef double real;
+typedef unsigned int index_type;
+
+// The types the search uses over graph type G
+template <typename G>
+struct search_types {
+  typedef G graph_type;
+  typedef EH_search_path<typename G::value_type, G> spath_type;
+  typedef typename spath_type::record_type record_type;
+  typedef record_pool<record_type> pool_type;
+  typedef record_type* task_type;
+  typedef spath_type answer_type;
+  typedef search_manager<task_type, answer_type> manager_type;
+  typedef path_bound<spath_type> bound_type;
+  typedef dominance_table<typename G::value_type> dominance_type;
+};
+
+// What a search builds from the graph and can leave to the next search
+// of the same graph with the same options: the candidate lists, every
+// thread's bound (whose Held-Karp multipliers are a warm start) and the
+// dominance table, which is cleared for each search. After distances
+// change, the lists of the nodes concerned are rebuilt.
+template <typename G>
+struct search_cache {
+  typedef typename search_types<G>::bound_type bound_type;
+  typedef typename search_types<G>::dominance_type dominance_type;
+  std::unique_ptr< candidate_lists<G> > cand;
+  std::vector< std::unique_ptr<bound_type> > bounds;
+  std::unique_ptr<dominance_type> table;
+};
+
+// The default graph, held in memory
+typedef Euclidean_set<real> graph_type;
+typedef search_types<graph_type>::spath_type spath_type;
+typedef search_types<graph_type>::answer_type answer_type;
+typedef Euclidean_path<real> gpath_type;
+
+enum bound_kind { weight_kind, mst_kind, held_karp_kind };
+enum engine_kind { auto_engine, bnb_engine, dp_engine, heuristic_engine };
+
+// Largest graph the automatic engine choice gives to the dynamic
+// program. Its cost is fixed (a few ms here) while the bounded search
+// usually wins beyond this, but can be much slower on hard instances.
+constexpr index_type dp_auto_max = 12;
+
+// Largest graph for the fixed-size kernels (fixed_impl.hh); they are
+// instantiated for 32 and 64 nodes
+constexpr index_type fixed_max = 64;
+
+// branch_level that splits work off on demand instead of at fixed levels
+constexpr index_type adaptive_level = index_type(-1);
+
+struct solve_options {
+  // Subtrees at or above this level are split off as tasks, or on demand
+  // if adaptive_level
+  index_type branch_level = adaptive_level, restarts = 16;
+  bound_kind bound = held_karp_kind;
+  engine_kind engine = auto_engine;
+  path_mode mode = fixed_start;
+  std::size_t dp_memory = held_karp_memory_limit();
+  // Order in which split-off tasks are handed out
+  select_policy select = lifo_select;
+  // Children are expanded nearest first along lists of this many nearest
+  // nodes (0: all nodes), or in index order if not nearest_first
+  bool nearest_first = true;
+  index_type candidates = 0;
+  // Graphs of up to fixed_max nodes are searched with the fixed-size
+  // kernels, otherwise with the generic ones
+  bool fixed_kernels = true;
+  // Memory for the dominance table in bytes (0: none). Only the
+  // fixed-size kernels use it.
+  std::size_t dominance_memory = std::size_t(16) << 20;
+  // Checkpoint file written every checkpoint_interval seconds and when
+  // the search ends (empty: none), and checkpoint file to resume from
+  // (empty: start afresh)
+  std::string checkpoint, resume;
+  double checkpoint_interval = 300;
+  // This process's part in a distributed search (nullptr: search alone)
+  search_cluster *cluster = nullptr;
+  // Anytime search: stop after time_limit seconds (0: no limit) and
+  // settle for an answer within a fraction gap of the optimum (0: the
+  // optimum). The dynamic program has no time limit: it cannot be asked
+  // for one, and auto only picks it for graphs it solves in
+  // milliseconds. The heuristic engine starts no restart but the first
+  // after time_limit, and has no use for gap. on_incumbent, if set, gets every better answer (node order
+  // and weight) as soon as it is found; it is called under a lock, so it
+  // must be quick and must not throw.
+  double time_limit = 0, gap = 0;
+  std::function<void(const std::vector<std::size_t>&, double)> on_incumbent;
+  // A lower bound known in advance (0: none): the search ends as soon as
+  // its answer is no heavier
+  double floor = 0;
+};
+
+// What a solve did, for benchmarks
+struct solve_stats {
+  solve_stats() : nodes(0), incumbents(), threads(), lower_bound(0), complete(false) { }
+  // Search nodes checked against the bound
+  std::size_t nodes;
+  // Weight of every answer the search kept, and when it was found
+  // (omp_get_wtime()); the first one is the seed
+  std::vector< std::pair<double, real> > incumbents;
+  // Per-thread counters (empty unless built with SEARCH_STATS)
+  counters_vector threads;
+  // No path is lighter than lower_bound. complete if the search ran to
+  // the end (the answer is within the gap of the optimum), false if the
+  // time limit stopped it.
+  real lower_bound;
+  bool complete;
+};
+
+
+inline bound_kind parse_bound(const std::string &name) {
+  if (name == "weight") return weight_kind;
+  if (name == "mst") return mst_kind;
+  if (name == "hk") return held_karp_kind;
+  throw std::runtime_error("Unknown bound: " + name);
+}
+
+inline path_mode parse_mode(const std::string &name) {
+  if (name == "fixed") return fixed_start;
+  if (name == "free") return free_start;
+  if (name == "closed") return closed_tour;
+  throw std::runtime_error("Unknown mode: " + name);
+}
+
+inline select_policy parse_select(const std::string &name) {
+  if (name == "lifo") return lifo_select;
+  if (name == "fifo") return fifo_select;
+  if (name == "best") return best_select;
+  if (name == "hybrid") return hybrid_select;
+  throw std::runtime_error("Unknown selection policy: " + name);
+}
+
+inline engine_kind parse_engine(const std::string &name) {
+  if (name == "auto") return auto_engine;
+  if (name == "bnb") return bnb_engine;
+  if (name == "dp") return dp_engine;
+  if (name == "heuristic") return heuristic_engine;
+  throw std::runtime_error("Unknown engine: " + name);
+}
+
+// Each thread needs its own bound (they keep scratch space)
+template <typename G>
+typename search_types<G>::bound_type* make_bound(bound_kind kind, const G &g) {
+  typedef typename search_types<G>::spath_type path_type;
+  switch (kind) {
+  case weight_kind: return new weight_bound<path_type>();
+  case mst_kind: return new mst_bound<path_type>(g);
+  default: return new held_karp_bound<path_type>(g);
+  }
+}
+
+// Prefixes with fewer open nodes than this skip the dominance table:
+// their subtrees cost less to search than the lookups
+constexpr index_type dominance_min_open = 3;
+
+// True if a prefix in the same state as sp and no heavier than it is in
+// the table; otherwise sp is recorded. Only for paths with a node mask.
+template <typename P>
+bool prefix_dominated(const P &sp, dominance_table<typename P::value_type> *table) {
+  (void)sp; (void)table;
+  return false;
+}
+
+template <typename T, std::size_t N>
+bool prefix_dominated(const EH_search_path< T, fixed_set<T,N> > &sp, dominance_table<T> *table) {
+  if (!table || sp.global_level() == 0 || sp.graph().size() - sp.size() < dominance_min_open)
+    return false;
+  return table->dominated(sp.open_nodes(), sp.back(), sp.anchor_node(), sp.size(), sp.weight());
+}
+
+// True if no completion of sp can beat the best answer found by any
+// thread so far (by more than the gap), if its mirror image is searched instead, or if a
+// lighter prefix in the same state was seen. Otherwise the bound is left
+// in lb. A prefix pruned by the bound stays in the table: the heavier
+// ones in its state cannot beat the answer either.
+template <typename P, typename M>
+bool dominated(const P &sp, M &manager, path_bound<P> &bound,
+               dominance_table<typename P::value_type> *table, typename P::value_type &lb) {
+  if (sp.mirrored()) return true;
+  if (prefix_dominated(sp, table)) { manager.counters().node_dominated(); return true; }
+  const typename P::value_type cutoff = manager.cutoff();
+  lb = bound(sp, cutoff);
+  return lb > cutoff;
+}
+
+// How many nodes to check between looks at the demand for work
+constexpr std::size_t demand_poll = 64;
+
+// Hand what is left of the task back to the manager while it drains
+// for a checkpoint: the subtree below the current node, which was
+// checked and has bound lb, and the later siblings at every level
+template <typename P, typename M>
+void give_back(P &sp, M &manager, record_pool<typename P::record_type> &pool,
+               const typename P::value_type lb) {
+  typedef typename P::record_type record_type;
+  if (!sp.is_bottom()) {
+    record_type *rec = pool.allocate(sp.size());
+    rec->assign(sp.begin(), sp.end(), sp.weight());
+    rec->set_bound(lb);
+    manager.give(rec);
+  }
+  for (std::size_t l=sp.level(); l>=1; l--) {
+    if (!sp.has_later_siblings(l)) continue;
+    record_type *rec = pool.allocate(sp.size() - sp.level() + l - 1);
+    sp.donate(l, *rec);
+    manager.give(rec);
+  }
+}
+
+// Search the task sp was assigned (the subtree below it, or the
+// siblings from its current node on); returns the number of nodes
+// checked. With a fixed branch_level, every node at or above it is
+// split off except the last sibling; adaptively, the shallowest
+// unexplored siblings are donated whenever the manager is short of work.
+// While the manager drains, the rest of the task is given back.
+template <typename P, typename M>
+std::size_t find_path_task(P &sp, M &manager, path_bound<P> &bound,
+                           dominance_table<typename P::value_type> *table,
+                           record_pool<typename P::record_type> &pool,
+                           const index_type branch_level) {
+  typedef typename P::record_type record_type;
+  search_counters &counters = manager.counters();
+  const bool adaptive = (branch_level == adaptive_level);
+  std::size_t nodes = 0, poll = demand_poll;
+  typename P::value_type lb = typename P::value_type();
+  bool descend = sp.is_top();
+  do {
+    if (descend) sp.iterate_dfs();
+    descend = true;
+    // Skip ahead past dominated branches. The sibling landed on has to
+    // be checked as well before descending into it.
+    while (!sp.is_top() && (nodes++, dominated(sp, manager, bound, table, lb))) {
+      counters.node_pruned(sp.global_level());
+      sp.next_branch();
+    }
+    if (sp.is_top()) break;
+    if (sp.is_bottom()) {
+      // If we got here, the answer is better than the bound when it
+      // was checked. Submit it to the manager, which will ensure it's
+      // _actually_ better.
+      manager.conclude(sp);
+    }
+    else if (!adaptive && sp.global_level() <= branch_level && !sp.last_branch()) {
+      // Branch off and submit back to the queue, then check the next
+      // sibling like any other. The last one is kept.
+      record_type *rec = pool.allocate(sp.size());
+      sp.split(*rec);
+      rec->set_bound(lb);
+      manager.give(rec);
+      counters.task_split();
+      descend = false;
+    }
+    else counters.node_expanded();
+
+    // Only between nodes whose subtree is still ahead (not right after a
+    // split, which already moved on to the next sibling)
+    if (descend && nodes >= poll) {
+      poll = nodes + demand_poll;
+      if (manager.draining()) {
+        give_back(sp, manager, pool, lb);
+        break;
+      }
+      if (adaptive && manager.hungry()) {
+        const std::size_t l = sp.donor_level(manager.split_grain());
+        if (l > 0) {
+          record_type *rec = pool.allocate(sp.size() - sp.level() + l - 1);
+          sp.donate(l, *rec);
+          manager.give(rec);
+          counters.task_split();
+        }
+      }
+    }
+  } while (!sp.is_top());
+  counters.nodes_checked(nodes);
+  return nodes;
+}
+
+// Initial answer for the search: the best of `restarts` heuristic
+// paths, or the longest_path() sentinel if there are none
+template <typename G>
+typename search_types<G>::answer_type seed_path(const G &g, const index_type restarts,
+                                                const path_mode mode) {
+  typedef typename search_types<G>::answer_type answer_type;
+  if (restarts == 0) return longest_path(g);
+  return answer_type(g, heuristic_order(g, 0, restarts, mode), mode);
+}
+
+// The only path through a graph of fewer than two nodes, which the
+// search cannot branch on
+template <typename G>
+typename search_types<G>::answer_type trivial_path(const G &g, const path_mode mode) {
+  typedef typename search_types<G>::answer_type answer_type;
+  typename answer_type::container_type o(g.size());
+  std::iota(o.begin(), o.end(), 0);
+  return answer_type(g, o, mode);
+}
+
+// The header fields that tie a checkpoint to the graph and the options
+// its tasks depend on
+template <typename G>
+checkpoint_header checkpoint_key(const G &g, const solve_options &opt) {
+  checkpoint_header h = checkpoint_header();
+  h.mode = opt.mode;
+  h.n = g.size();
+  h.checksum = graph_checksum(g);
+  h.nearest_first = opt.nearest_first;
+  h.candidates = opt.nearest_first ? opt.candidates : 0;
+  return h;
+}
+
+// The queued tasks and the answer of a paused manager
+template <typename M>
+search_checkpoint take_checkpoint(M &manager, const checkpoint_header &key,
+                                  std::size_t nodes, double seconds) {
+  search_checkpoint c;
+  c.header = key;
+  c.header.nodes = nodes;
+  c.header.seconds = seconds;
+  manager.for_each_task([&c](const typename M::task_type &t) {
+    c.add_task(t->begin(), t->end(), t->weight(), t->bound(), t->first_child());
+  });
+  const typename M::answer_type a = manager.answer_copy();
+  c.weight = a.weight();
+  // Nothing was found if the answer is still the longest_path() sentinel
+  if (a.size() == key.n) c.answer.assign(a.begin(), a.end());
+  return c;
+}
+
+// Throws unless checkpoint c, read from filename, fits the graph and
+// options of key
+inline void check_resume(const search_checkpoint &c, const checkpoint_header &key,
+                         const std::string &filename) {
+  const checkpoint_header &h = c.header;
+  if (h.n != key.n || h.checksum != key.checksum)
+    throw std::runtime_error(filename + ": checkpoint of another graph");
+  if (h.mode != key.mode || h.nearest_first != key.nearest_first || h.candidates != key.candidates)
+    throw std::runtime_error(filename + ": checkpoint with another --mode or --candidates");
+  for (std::uint32_t i : c.nodes)
+    if (i >= h.n) throw std::runtime_error(filename + ": bad task");
+  for (std::uint32_t i : c.answer)
+    if (i >= h.n) throw std::runtime_error(filename + ": bad answer");
+}
+
+// Watches a running search from its own thread: writes a checkpoint
+// every interval (if there is a file), and stops the search once the
+// time limit is up (if there is one). Either way it pauses the manager
+// and waits for the workers to give their tasks back; a checkpoint then
+// takes the queued tasks and resumes, while a stopped search keeps them
+// queued for the caller.
+template <typename M>
+class search_monitor {
+public:
+  search_monitor(M &m, const checkpoint_header &k, const std::string &f, double interval,
+                 double time_limit, std::size_t base_nodes, double base_seconds) :
+    manager(m), key(k), filename(f), period(f.empty() ? 0 : interval), limit(time_limit),
+    nodes0(base_nodes), seconds0(base_seconds), start(omp_get_wtime()), over(false),
+    error(), mutex(), wake(), thread(&search_monitor::run, this) { }
+
+  ~search_monitor() { stop(); }
+
+  // Stop watching at the end of the search (rethrows a write error)
+  void stop() {
+    if (!thread.joinable()) return;
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      over = true;
+    }
+    wake.notify_one();
+    thread.join();
+    if (error) std::rethrow_exception(error);
+  }
+
+  // Time searched by now, including the runs resumed from
+  double seconds() const { return seconds0 + omp_get_wtime() - start; }
+
+private:
+  void run() {
+    try {
+      std::unique_lock<std::mutex> guard(mutex);
+      double next = period;
+      for (;;) {
+        // Seconds since start of the next checkpoint or the time limit
+        double t = (period > 0) ? next : 0;
+        if (limit > 0 && (t == 0 || limit < t)) t = limit;
+        if (t == 0) { wake.wait(guard, [this] { return over; }); return; }
+        const std::chrono::duration<double> wait(std::max(0.0, start + t - omp_get_wtime()));
+        if (wake.wait_for(guard, wait, [this] { return over; })) return;
+        manager.pause();
+        while (!manager.paused() && !manager.done())
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+        if (manager.done()) { manager.resume(); return; }
+        if (limit > 0 && omp_get_wtime() - start >= limit) { manager.halt(); return; }
+        const search_checkpoint c =
+          take_checkpoint(manager, key, nodes0 + manager.nodes(), seconds());
+        manager.resume();
+        write_checkpoint(filename, c);
+        next += period;
+      }
+    }
+    catch (...) {
+      error = std::current_exception();
+      manager.resume();
+    }
+  }
+
+  M &manager;
+  const checkpoint_header key;
+  const std::string filename;
+  const double period, limit;
+  const std::size_t nodes0;
+  const double seconds0, start;
+  bool over;
+  std::exception_ptr error;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::thread thread;
+};
+
+// The root tasks of a search. Paths start at node 0, and so do tours
+// (their lowest node). Free paths get a root for every first node; the
+// last node is never one since the reverse path is searched instead.
+template <typename G>
+search_checkpoint root_tasks(const G &g, const path_mode mode) {
+  typedef typename search_types<G>::spath_type spath_type;
+  search_checkpoint c;
+  const index_type nroot = (mode == free_start && g.size() > 1) ? g.size() - 1 : 1;
+  for (index_type r=0; r<nroot; r++) {
+    const spath_type root(g, r, mode);
+    c.add_task(root.begin(), root.end(), root.weight(), root.weight(), 0);
+  }
+  return c;
+}
+
+// Links the search of a batch to the rest of a distributed search, from
+// its own thread: passes better answers both ways and takes queued tasks
+// away when the coordinator asks for some
+template <typename G, typename M>
+class cluster_link {
+public:
+  typedef typename M::answer_type answer_type;
+  typedef typename M::task_type task_type;
+  typedef typename answer_type::value_type value_type;
+
+  // sent: weight of the best answer the coordinator knows of
+  cluster_link(const G &graph, path_mode m, M &man, message_channel &c, value_type sent) :
+    g(graph), mode(m), manager(man), channel(c), published(sent), stealing(false),
+    over(false), error(), thread(&cluster_link::run, this) { }
+
+  ~cluster_link() { if (thread.joinable()) { over = true; thread.join(); } }
+
+  // At the end of the batch: hands on the last answer found (rethrows a
+  // transport error)
+  void stop() {
+    over = true;
+    thread.join();
+    if (error) std::rethrow_exception(error);
+    publish();
+    manager.want(0);
+  }
+
+private:
+  // How often to look for messages and better answers, in milliseconds
+  enum { tick_ms = 1 };
+
+  void run() {
+    try {
+      while (!over) {
+        if (channel.ready(tick_ms)) receive();
+        publish();
+        if (stealing) give_work();
+      }
+    }
+    catch (...) { error = std::current_exception(); }
+  }
+
+  void receive() {
+    message_kind kind;
+    search_checkpoint c;
+    if (!channel.receive(kind, c)) throw std::runtime_error("Lost connection to the coordinator");
+    if (kind == incumbent_message) {
+      if (c.weight < published) published = c.weight;
+      manager.offer(answer_type(g, std::vector<std::size_t>(c.answer.begin(), c.answer.end()),
+                                mode));
+    }
+    else if (kind == steal_message) {
+      stealing = true;
+      manager.want(2 * omp_get_max_threads());
+    }
+    else throw std::runtime_error("Unexpected message from the coordinator");
+  }
+
+  void publish() {
+    if (!(manager.bound() < published)) return;
+    const answer_type a = manager.answer_copy();
+    if (!(a.weight() < published) || a.size() != g.size()) return;
+    search_checkpoint c;
+    c.weight = a.weight();
+    c.answer.assign(a.begin(), a.end());
+    channel.send(incumbent_message, c);
+    published = a.weight();
+  }
+
+  // Half the queued tasks, once there are two. Taken records are not
+  // released: the pools free them with the batch.
+  void give_work() {
+    const std::size_t nq = manager.queued();
+    if (nq < 2) return;
+    search_checkpoint c;
+    task_type t;
+    while (c.task.size() < nq / 2 && manager.take(t))
+      c.add_task(t->begin(), t->end(), t->weight(), t->bound(), t->first_child());
+    if (c.task.empty()) return;
+    channel.send(work_message, c);
+    stealing = false;
+    manager.want(0);
+  }
+
+  const G &g;
+  const path_mode mode;
+  M &manager;
+  message_channel &channel;
+  value_type published;
+  bool stealing;
+  std::atomic<bool> over;
+  std::exception_ptr error;
+  std::thread thread;
+};
+
+// The lower bound of a search that was stopped with the tasks in the
+// queues of manager: every path not searched yet completes one of them,
+// and none that was pruned beats the answer by more than the gap
+template <typename G, typename M>
+typename G::value_type open_bound(const G &g, const solve_options &opt, M &manager,
+                                  typename search_types<G>::pool_type &pool) {
+  typedef search_types<G> types;
+  typedef typename types::record_type record_type;
+  typedef typename G::value_type value_type;
+  const value_type ub = manager.answer().weight();
+  value_type lb = ub * (1 - opt.gap);
+  if (!manager.halted()) return lb;
+  std::unique_ptr<typename types::bound_type> bound(make_bound(opt.bound, g));
+  typename types::spath_type sp(g, opt.mode);
+  manager.for_each_task([&](const typename M::task_type &t) {
+    // Split-off tasks carry their bound. Otherwise the bound of the
+    // prefix holds for any of its children.
+    if (t->first_child() == 0 && t->bound() > t->weight()) {
+      lb = std::min(lb, t->bound());
+      return;
+    }
+    record_type *rec = pool.allocate(t->size());
+    rec->assign(t->begin(), t->end(), t->weight());
+    sp.assign(*rec);
+    pool.release(rec);
+    lb = std::min(lb, (*bound)(sp, ub));
+  });
+  return lb;
+}
+
+// The parallel search of the tasks in start, with its answer as the
+// initial one (or a seed_path() if it has none); a checkpoint to resume
+// from also brings the nodes and the time so far. With a link, this is
+// one batch of a distributed search. A cache keeps the candidate lists
+// and bounds for the next search.
+template <typename G>
+const typename search_types<G>::answer_type search_tasks(const G &g, const solve_options &opt,
+                                                         const search_checkpoint &start,
+                                                         solve_stats *stats,
+                                                         message_channel *link=nullptr,
+                                                         search_cache<G> *cache=nullptr) {
+  typedef search_types<G> types;
+  typedef typename types::spath_type spath_type;
+  typedef typename types::record_type record_type;
+  typedef typename types::pool_type pool_type;
+  typedef typename types::task_type task_type;
+  typedef typename types::manager_type manager_type;
+  typedef typename types::bound_type bound_type;
+  typedef typename types::dominance_type dominance_type;
+  // The time limit includes the seed
+  const double entry = omp_get_wtime();
+
+  // One record pool per thread, all kept until the search is over since
+  // records are released by whichever thread finishes them
+  std::vector< std::unique_ptr<pool_type> > pools(omp_get_max_threads());
+  for (std::size_t i=0; i<pools.size(); i++) pools[i].reset(new pool_type());
+
+  std::vector<record_type*> roots;
+  for (const checkpoint_task &t : start.task) {
+    record_type *rec = pools[0]->allocate(t.length);
+    rec->assign(start.nodes.begin() + t.offset, start.nodes.begin() + t.offset + t.length, t.weight);
+    rec->set_bound(t.bound);
+    rec->set_first_child(t.first_child);
+    roots.push_back(rec);
+  }
+  const spath_type initial = start.answer.empty() ? seed_path(g, opt.restarts, opt.mode)
+    : spath_type(g, std::vector<std::size_t>(start.answer.begin(), start.answer.end()), opt.mode);
+  const std::size_t base_nodes = start.header.nodes;
+  if (stats) {
+    stats->nodes = base_nodes;
+    stats->incumbents.assign(1, std::make_pair(omp_get_wtime(), initial.weight()));
+    stats->threads.clear();
+    stats->lower_bound = initial.weight() * (1 - opt.gap);
+    stats->complete = true;
+  }
+  if (opt.on_incumbent && !link && initial.size() == g.size())
+    opt.on_incumbent(std::vector<std::size_t>(initial.begin(), initial.end()), initial.weight());
+  // A finished search left no tasks
+  if (roots.empty()) return initial;
+
+  search_cache<G> scratch;
+  search_cache<G> &kept = cache ? *cache : scratch;
+  if (opt.nearest_first && !kept.cand) kept.cand.reset(new candidate_lists<G>(g, opt.candidates));
+  const candidate_lists<G> *cand = opt.nearest_first ? kept.cand.get() : nullptr;
+  if (kept.bounds.size() < pools.size()) kept.bounds.resize(pools.size());
+  std::unique_ptr<dominance_type> &table = kept.table;
+  if (opt.dominance_memory > 0 && has_node_mask<spath_type>::value) {
+    if (table) table->clear();
+    else table.reset(new dominance_type(opt.dominance_memory));
+  }
+  manager_type manager(roots[0], initial, opt.select);
+  for (std::size_t r=1; r<roots.size(); r++) manager.give(roots[r]);
+  manager.relax(opt.gap);
+  if (opt.floor > 0) manager.settle(opt.floor);
+  if (opt.on_incumbent)
+    manager.on_improve([&opt](const spath_type &a) {
+      opt.on_incumbent(std::vector<std::size_t>(a.begin(), a.end()), a.weight());
+    });
+  const checkpoint_header key = opt.checkpoint.empty() ? checkpoint_header() : checkpoint_key(g, opt);
+  const bool watched = !opt.checkpoint.empty() || opt.time_limit > 0;
+  std::unique_ptr< search_monitor<manager_type> > monitor;
+  std::unique_ptr< cluster_link<G, manager_type> > remote;
+  if (link)
+    remote.reset(new cluster_link<G, manager_type>(g, opt.mode, manager, *link, initial.weight()));
+
+#pragma omp parallel shared(manager, pools, monitor)
+  {
+    manager.join();
+    // The monitor waits for the whole team to park, so it starts once
+    // every thread has joined
+#pragma omp barrier
+#pragma omp master
+    if (watched) {
+      const double limit = (opt.time_limit > 0)
+        ? std::max(opt.time_limit - (omp_get_wtime() - entry), 1e-6) : 0;
+      monitor.reset(new search_monitor<manager_type>(manager, key, opt.checkpoint,
+                                                     opt.checkpoint_interval, limit,
+                                                     base_nodes, start.header.seconds));
+    }
+    std::unique_ptr<bound_type> &bound = kept.bounds[omp_get_thread_num()];
+    if (!bound) bound.reset(make_bound(opt.bound, g));
+    pool_type &pool = *pools[omp_get_thread_num()];
+    spath_type sp(g, opt.mode);
+    sp.use_candidates(cand);
+    const bool adaptive = (opt.branch_level == adaptive_level);
+    task_type rec;
+    while (!manager.done()) {
+      if (manager.get(rec)) {
+        const double start = adaptive ? omp_get_wtime() : 0;
+        sp.assign(*rec);
+        manager.add_nodes(find_path_task(sp, manager, *bound, table.get(), pool,
+                                         opt.branch_level));
+        if (adaptive) manager.task_time(omp_get_wtime() - start);
+        pool.release(rec);
+        manager.finish(rec);
+      }
+      else manager.idle();
+    }
+  }
+  if (remote) remote->stop();
+  if (monitor) monitor->stop();
+  if (!opt.checkpoint.empty()) {
+    // The last checkpoint has the tasks a time limit left, if any;
+    // resuming from one without tasks returns the answer
+    write_checkpoint(opt.checkpoint,
+                     take_checkpoint(manager, key, base_nodes + manager.nodes(), monitor->seconds()));
+  }
+  if (stats) {
+    stats->nodes = base_nodes + manager.nodes();
+    stats->incumbents.clear();
+    for (const auto &inc : manager.incumbents())
+      stats->incumbents.emplace_back(inc.time, inc.weight);
+    stats->threads = manager.all_counters();
+    stats->lower_bound = open_bound(g, opt, manager, *pools[0]);
+    stats->complete = !manager.halted();
+  }
+  return manager.answer();
+}
+
+// This process's part of a distributed search (distributed_impl.hh):
+// search batches of tasks until the coordinator says it is over. Every
+// process returns the answer, and the nodes checked by all of them.
+template <typename G>
+const typename search_types<G>::answer_type distributed_search(const G &g, const solve_options &opt,
+                                                               solve_stats *stats) {
+  typedef typename search_types<G>::answer_type answer_type;
+  if (!opt.checkpoint.empty() || !opt.resume.empty())
+    throw std::runtime_error("Checkpoints are not supported in distributed searches");
+  if (opt.time_limit > 0)
+    throw std::runtime_error("Time limits are not supported in distributed searches");
+  search_cluster &cluster = *opt.cluster;
+  message_channel &link = cluster.channel();
+  solve_options batch_opt = opt;
+  batch_opt.cluster = nullptr;
+  batch_opt.restarts = 0;
+  if (stats) *stats = solve_stats();
+
+  try {
+    search_checkpoint c;
+    c.header = checkpoint_key(g, opt);
+    if (cluster.coordinator()) cluster.start(c.header);
+    link.send(hello_message, c);
+    // The coordinator seeds the search and brings the roots
+    search_checkpoint best;
+    if (cluster.coordinator()) {
+      const answer_type seed = seed_path(g, opt.restarts, opt.mode);
+      if (seed.size() == g.size()) {
+        best.weight = seed.weight();
+        best.answer.assign(seed.begin(), seed.end());
+        link.send(incumbent_message, best);
+        if (stats) stats->incumbents.emplace_back(omp_get_wtime(), best.weight);
+      }
+      link.send(work_message, root_tasks(g, opt.mode));
+    }
+    search_checkpoint request;
+    for (;;) {
+      link.send(request_message, request);
+      message_kind kind;
+      do {
+        if (!link.receive(kind, c)) throw std::runtime_error("Lost connection to the coordinator");
+        if (kind == incumbent_message && (best.answer.empty() || c.weight < best.weight)) {
+          best.weight = c.weight;
+          best.answer = c.answer;
+          if (stats) stats->incumbents.emplace_back(omp_get_wtime(), best.weight);
+        }
+      } while (kind != tasks_message && kind != stop_message);
+      if (kind == stop_message) break;
+
+      if (!best.answer.empty() && (c.answer.empty() || best.weight < c.weight)) {
+        c.weight = best.weight;
+        c.answer = best.answer;
+      }
+      solve_stats batch;
+      const typename search_types<G>::answer_type a = search_tasks(g, batch_opt, c, &batch, &link);
+      if (a.size() == g.size() && (best.answer.empty() || a.weight() < best.weight)) {
+        best.weight = a.weight();
+        best.answer.assign(a.begin(), a.end());
+      }
+      request.header.nodes = batch.nodes;
+      if (stats) {
+        for (std::size_t i=1; i<batch.incumbents.size(); i++)
+          stats->incumbents.push_back(batch.incumbents[i]);
+        if (stats->threads.size() < batch.threads.size()) stats->threads.resize(batch.threads.size());
+        for (std::size_t i=0; i<batch.threads.size(); i++) stats->threads[i] += batch.threads[i];
+      }
+    }
+    if (cluster.coordinator()) cluster.finish();
+    if (stats) {
+      stats->nodes = c.header.nodes;
+      stats->lower_bound = c.weight * (1 - opt.gap);
+      stats->complete = true;
+    }
+    if (c.answer.empty()) return longest_path(g);
+    return answer_type(g, std::vector<std::size_t>(c.answer.begin(), c.answer.end()), opt.mode);
+  }
+  catch (...) {
+    // The scheduler's error comes first: it closed the connections
+    if (cluster.coordinator()) cluster.finish();
+    throw;
+  }
+}
+
+// The parallel branch-and-bound search over G itself: from the start,
+// from a checkpoint, or as part of a distributed search
+template <typename G>
+const typename search_types<G>::answer_type branch_and_bound(const G &g, const solve_options &opt,
+                                                             solve_stats *stats=nullptr) {
+  if (opt.cluster) return distributed_search(g, opt, stats);
+  if (opt.resume.empty()) return search_tasks(g, opt, root_tasks(g, opt.mode), stats);
+  // The tasks left by the checkpointed run, its answer and progress
+  const search_checkpoint c = read_checkpoint(opt.resume);
+  check_resume(c, checkpoint_key(g, opt), opt.resume);
+  return search_tasks(g, opt, c, stats);
+}
+
+// The search over a fixed_set<T,N> copy of g, with the answer mapped
+// back onto g
+template <std::size_t N, typename G>
+const typename search_types<G>::answer_type find_path_fixed(const G &g, const solve_options &opt,
+                                                            solve_stats *stats) {
+  typedef typename search_types<G>::answer_type answer_type;
+  const fixed_set<typename G::value_type, N> fg(g);
+  const auto sp = branch_and_bound(fg, opt, stats);
+  // Nothing was found if the answer is still the longest_path() sentinel
+  if (sp.size() < g.size()) return longest_path(g);
+  return answer_type(g, typename answer_type::container_type(sp.begin(), sp.end()), opt.mode);
+}
+
+// Branch and bound, with the fixed-size kernels for the smallest
+// instantiated N >= g.size() if enabled
+template <typename G>
+const typename search_types<G>::answer_type find_path(const G &g, const solve_options &opt,
+                                                      solve_stats *stats=nullptr) {
+  if (g.size() < 2) return trivial_path(g, opt.mode);
+  if (opt.fixed_kernels) {
+    if (g.size() <= 32) return find_path_fixed<32>(g, opt, stats);
+    if (g.size() <= fixed_max) return find_path_fixed<fixed_max>(g, opt, stats);
+  }
+  return branch_and_bound(g, opt, stats);
+}
+
+// Solve with the engine asked for, or pick one by size (never the
+// heuristic, which is not exact). Statistics other than the lower bound
+// are only filled in by the branch-and-bound search.
+template <typename G>
+const typename search_types<G>::answer_type solve(const G &g, const solve_options &opt,
+                                                  solve_stats *stats=nullptr) {
+  typedef typename search_types<G>::answer_type answer_type;
+  engine_kind engine = opt.engine;
+  const bool fits = held_karp_fits(g, opt.dp_memory, opt.mode);
+  if (engine == auto_engine)
+    engine = (g.size() <= dp_auto_max && fits) ? dp_engine : bnb_engine;
+  // Graphs of fewer than two nodes have a single path, which the
+  // search cannot branch on
+  if (engine == dp_engine || g.size() < 2) {
+    if (opt.engine == dp_engine && opt.time_limit > 0)
+      throw std::runtime_error("Time limits are not supported by the dynamic program");
+    if (g.size() >= 2 && !fits) throw std::runtime_error("Dynamic program exceeds the memory limit (--dp-memory)");
+    const answer_type a = (g.size() < 2) ? trivial_path(g, opt.mode)
+      : answer_type(g, held_karp_order(g, 0, opt.mode), opt.mode);
+    if (opt.on_incumbent) opt.on_incumbent(std::vector<std::size_t>(a.begin(), a.end()), a.weight());
+    if (stats) {
+      stats->lower_bound = a.weight();
+      stats->complete = true;
+    }
+    return a;
+  }
+  if (engine == heuristic_engine) {
+    // As good as the moves get it, with no lower bound
+    const double deadline = (opt.time_limit > 0) ? omp_get_wtime() + opt.time_limit : 0;
+    const answer_type a(g, lk_order(g, opt.restarts, opt.nearest_first ? opt.candidates : 0, opt.mode,
+                                    deadline), opt.mode);
+    if (opt.on_incumbent) opt.on_incumbent(std::vector<std::size_t>(a.begin(), a.end()), a.weight());
+    if (stats) {
+      stats->incumbents.emplace_back(omp_get_wtime(), a.weight());
+      stats->lower_bound = 0;
+      stats->complete = false;
+    }
+    return a;
+  }
+  return find_path(g, opt, stats);
+}
+
+
+#endif
@@ -1,44 +1,144 @@
 #ifndef SQUARE_SYMMETRIC_MATRIX_HH
 #define SQUARE_SYMMETRIC_MATRIX_HH
 
+#include <stdlib.h>
+#include <cstddef>
 #include <vector>
 #include <ostream>
+#include <new>
+#include <utility>
+#include <stdexcept>
+#include <algorithm>
 
-template < typename T, typename Container=std::vector<T> >
+// Storage layouts, mapping (i,j) to an offset in the container
+
+// Every entry stored, row by row
+class full_layout {
+public:
+  typedef std::size_t size_type;
+  full_layout(size_type m, size_type elem) : n(m) { (void)elem; }
+  size_type size() const { return n*n; }
+  size_type operator()(size_type i, size_type j) const { return i*n + j; }
+private:
+  size_type n;
+};
+
+// Upper triangle only (including the diagonal), row by row; (i,j) and
+// (j,i) share an entry. Half the memory of full_layout.
+class packed_layout {
+public:
+  typedef std::size_t size_type;
+  packed_layout(size_type m, size_type elem) : n(m) { (void)elem; }
+  size_type size() const { return n*(n+1)/2; }
+  size_type operator()(size_type i, size_type j) const {
+    const size_type lo = std::min(i, j), hi = std::max(i, j);
+    return lo*(2*n - lo - 1)/2 + hi;
+  }
+private:
+  size_type n;
+};
+
+// Every entry stored, with each row padded to a whole number of cache
+// lines so rows start aligned (given an aligned container)
+class padded_layout {
+public:
+  typedef std::size_t size_type;
+  enum { line = 64 };
+  padded_layout(size_type m, size_type elem) :
+    n(m), stride(((m*elem + line - 1) / line * line) / elem) { }
+  size_type size() const { return n*stride; }
+  size_type operator()(size_type i, size_type j) const { return i*stride + j; }
+private:
+  size_type n, stride;
+};
+
+
+// Allocator returning memory aligned to A bytes
+template <typename T, std::size_t A=64>
+class aligned_allocator {
+public:
+  typedef T value_type;
+  template <typename U> struct rebind { typedef aligned_allocator<U,A> other; };
+
+  aligned_allocator() { }
+  template <typename U> aligned_allocator(const aligned_allocator<U,A> &) { }
+
+  T* allocate(std::size_t n) {
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, A, n*sizeof(T)) != 0) throw std::bad_alloc();
+    return static_cast<T*>(ptr);
+  }
+  void deallocate(T *ptr, std::size_t) { free(ptr); }
+};
+
+template <typename T, typename U, std::size_t A>
+bool operator==(const aligned_allocator<T,A> &, const aligned_allocator<U,A> &) { return true; }
+
+template <typename T, typename U, std::size_t A>
+bool operator!=(const aligned_allocator<T,A> &, const aligned_allocator<U,A> &) { return false; }
+
+
+template < typename T, typename Container=std::vector<T>, typename Layout=full_layout >
 class square_symmetric_matrix {
 public:
   typedef T value_type;
   typedef Container container_type;
+  typedef Layout layout_type;
   typedef typename container_type::size_type size_type;
   typedef size_type index_type;
 
   square_symmetric_matrix() = delete;
   square_symmetric_matrix(size_type m, value_type v=value_type()) :
-    n(m), data(m*m, v) { }
+    n(m), layout(m, sizeof(value_type)), data(layout.size(), v) { }
+
+  // Wrap storage already holding the entries in this layout
+  square_symmetric_matrix(size_type m, container_type &&c) :
+    n(m), layout(m, sizeof(value_type)), data(std::move(c)) {
+    if (data.size() != layout.size()) throw std::length_error("square_symmetric_matrix: wrong storage size");
+  }
+
+  // Copy from a matrix with any other storage
+  template <typename C, typename L>
+  explicit square_symmetric_matrix(const square_symmetric_matrix<T,C,L> &other) :
+    n(other.size()), layout(n, sizeof(value_type)), data(layout.size()) {
+    for (index_type i=0; i<n; i++)
+      for (index_type j=0; j<n; j++) (*this)(i,j) = other(i,j);
+  }
 
   inline size_type size() const { return n; }
 
   inline value_type& operator()(index_type i, index_type j)
-  { return data[i*n + j]; }
+  { return data[layout(i,j)]; }
 
   inline const value_type& operator()(index_type i, index_type j) const
-  { return data[i*n + j]; }
+  { return data[layout(i,j)]; }
 
   inline void set(index_type i, index_type j, value_type dist)
   { square_symmetric_matrix &mat = *this; mat(i,j) = mat(j,i) = dist; }
 
   inline const value_type& get(index_type i, index_type j) const
-  { square_symmetric_matrix &mat = *this; return mat(i,j); }
+  { const square_symmetric_matrix &mat = *this; return mat(i,j); }
 
 private:
   size_type n;
+  layout_type layout;
   container_type data;
 };
 
-template<typename T, typename C>
-std::ostream& operator<<(std::ostream& os, const square_symmetric_matrix<T,C> &mat)
+// Row-padded matrix on cache-line aligned storage: the layout the search
+// reads from
+template <typename T>
+using padded_symmetric_matrix =
+  square_symmetric_matrix< T, std::vector< T, aligned_allocator<T> >, padded_layout >;
+
+// Upper-triangle matrix, for graphs too large to store twice
+template <typename T>
+using packed_symmetric_matrix = square_symmetric_matrix< T, std::vector<T>, packed_layout >;
+
+template<typename T, typename C, typename L>
+std::ostream& operator<<(std::ostream& os, const square_symmetric_matrix<T,C,L> &mat)
 {
-  typedef typename square_symmetric_matrix<T,C>::index_type index_type;
+  typedef typename square_symmetric_matrix<T,C,L>::index_type index_type;
   for (index_type i=0; i<mat.size(); i++) {
     for (index_type j=0; j<mat.size()-1; j++)
       os << mat(i,j) << "\t";
@@ -0,0 +1,130 @@
+#ifndef STATS_IMPL_HH
+#define STATS_IMPL_HH
+
+// Per-thread search counters. Each thread only touches its own, padded
+// to whole cache lines; they are merged once the search is over.
+// Unless SEARCH_STATS is defined they are empty and every call compiles
+// to nothing.
+#include "square_symmetric_matrix.hh"
+#include <omp.h>
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <ostream>
+
+#ifdef SEARCH_STATS
+
+class alignas(64) search_counters {
+public:
+  typedef std::size_t size_type;
+  enum { enabled = 1 };
+
+  search_counters() :
+    checked(0), expanded(0), dominated(0), splits(0), taken(0), stolen(0),
+    lock_wait(0), idle_time(0), pruned(), improvements() { }
+
+  void nodes_checked(size_type k) { checked += k; }
+  void node_pruned(size_type level) {
+    if (level >= pruned.size()) pruned.resize(level+1, 0);
+    pruned[level]++;
+  }
+  void node_expanded() { expanded++; }
+  // Pruned by the dominance table (also counted in node_pruned)
+  void node_dominated() { dominated++; }
+  void task_split() { splits++; }
+  void task_taken(bool steal) { if (steal) stolen++; else taken++; }
+  void waited(double seconds) { lock_wait += seconds; }
+  void idled(double seconds) { idle_time += seconds; }
+  void improved(double time, double weight) { improvements.emplace_back(time, weight); }
+
+  // Wall clock, only read when counting
+  static double now() { return omp_get_wtime(); }
+
+  search_counters& operator+=(const search_counters &o) {
+    checked += o.checked; expanded += o.expanded; dominated += o.dominated; splits += o.splits;
+    taken += o.taken; stolen += o.stolen;
+    lock_wait += o.lock_wait; idle_time += o.idle_time;
+    if (o.pruned.size() > pruned.size()) pruned.resize(o.pruned.size(), 0);
+    for (size_type l=0; l<o.pruned.size(); l++) pruned[l] += o.pruned[l];
+    improvements.insert(improvements.end(), o.improvements.begin(), o.improvements.end());
+    return *this;
+  }
+
+  // JSON object; times are in seconds, improvements relative to start
+  void write_json(std::ostream &os, double start) const {
+    os << "{\"nodes_checked\": " << checked << ", \"nodes_expanded\": " << expanded
+       << ", \"nodes_dominated\": " << dominated << ", \"pruned_by_level\": [";
+    for (size_type l=0; l<pruned.size(); l++) os << (l ? ", " : "") << pruned[l];
+    os << "], \"splits\": " << splits << ", \"tasks_taken\": " << taken
+       << ", \"tasks_stolen\": " << stolen << ", \"lock_wait\": " << lock_wait
+       << ", \"idle_time\": " << idle_time << ", \"improvements\": [";
+    for (size_type i=0; i<improvements.size(); i++)
+      os << (i ? ", " : "") << "[" << improvements[i].first - start
+         << ", " << improvements[i].second << "]";
+    os << "]}";
+  }
+
+private:
+  size_type checked, expanded, dominated, splits, taken, stolen;
+  double lock_wait, idle_time;
+  std::vector<size_type> pruned;
+  std::vector< std::pair<double, double> > improvements;
+};
+
+#else
+
+class search_counters {
+public:
+  typedef std::size_t size_type;
+  enum { enabled = 0 };
+
+  void nodes_checked(size_type) { }
+  void node_pruned(size_type) { }
+  void node_expanded() { }
+  void node_dominated() { }
+  void task_split() { }
+  void task_taken(bool) { }
+  void waited(double) { }
+  void idled(double) { }
+  void improved(double, double) { }
+
+  static double now() { return 0; }
+
+  search_counters& operator+=(const search_counters &) { return *this; }
+  void write_json(std::ostream &os, double) const { os << "null"; }
+};
+
+#endif
+
+// One set of counters per thread
+typedef std::vector< search_counters, aligned_allocator<search_counters> > counters_vector;
+
+// Lock l, adding the time spent waiting for it to c
+inline void timed_lock(omp_lock_t *l, search_counters &c) {
+#ifdef SEARCH_STATS
+  if (omp_test_lock(l)) return;
+  const double t0 = omp_get_wtime();
+  omp_set_lock(l);
+  c.waited(omp_get_wtime() - t0);
+#else
+  (void)c;
+  omp_set_lock(l);
+#endif
+}
+
+// {"threads": [...], "total": {...}}
+inline void write_counters_json(std::ostream &os, const counters_vector &v, double start) {
+  search_counters total;
+  os << "{\"threads\": [";
+  for (std::size_t i=0; i<v.size(); i++) {
+    os << (i ? ", " : "");
+    v[i].write_json(os, start);
+    total += v[i];
+  }
+  os << "], \"total\": ";
+  total.write_json(os, start);
+  os << "}";
+}
+
+
+#endif
@@ -3,13 +3,33 @@
 
 #include <cstddef>
 
-template <typename T>
-class task_queue {
+// Task queues and managers come in two forms, like the graphs, paths
+// and trees: a queue or manager type D derives from basic_task_queue<D,T>
+// or basic_task_manager<D,T,A> and provides the functions documented in
+// task_queue and task_manager below, which the search then calls without
+// virtual dispatch. task_queue and task_manager are the same interfaces
+// with virtual functions, for type erasure.
+template <typename D, typename T>
+class basic_task_queue {
 public:
   typedef T task_type;
   typedef std::size_t size_type;
+
+protected:
+  ~basic_task_queue() { }
+};
+
+template <typename T>
+class task_queue : public basic_task_queue<task_queue<T>, T> {
+public:
+  typedef basic_task_queue<task_queue<T>, T> base_type;
+  typedef typename base_type::task_type task_type;
+  typedef typename base_type::size_type size_type;
   virtual void add(const task_type &t) = 0;
-  virtual task_type get() = 0;
+  // Take a task for the owner (by default the newest); false if empty
+  virtual bool get(task_type &t) = 0;
+  // Take a task for another thread (by default the oldest); false if empty
+  virtual bool steal(task_type &t) = 0;
   virtual size_type size() = 0;
   virtual ~task_queue() { }
 private:
@@ -19,24 +39,93 @@ private:
 //   virtual void allocate() = 0;
 };
 
-template <typename T, typename A>
-class task_manager {
+template <typename D, typename T, typename A>
+class basic_task_manager {
 public:
   typedef T task_type;
   typedef A answer_type;
+  typedef std::size_t size_type;
+  typedef typename answer_type::value_type value_type;
+
+protected:
+  ~basic_task_manager() { }
+};
+
+template <typename T, typename A>
+class task_manager : public basic_task_manager<task_manager<T,A>, T, A> {
+public:
+  typedef basic_task_manager<task_manager<T,A>, T, A> base_type;
+  typedef typename base_type::task_type task_type;
+  typedef typename base_type::answer_type answer_type;
   typedef task_queue<T> tqueue_type;
-  typedef typename tqueue_type::size_type size_type;
+  typedef typename base_type::size_type size_type;
+  typedef typename base_type::value_type value_type;
 
-  virtual task_type get() = 0;
+  // Take a task for the calling thread; false if none could be found
+  virtual bool get(task_type &task) = 0;
   virtual void give(const task_type &task) = 0;
   virtual void finish(const task_type &task) = 0;
-  virtual answer_type& conclude(const answer_type &ans) = 0;
+  // Back off after get() came back empty
+  virtual void idle() = 0;
+  // Offer a complete answer; true if it became the new best
+  virtual bool conclude(const answer_type &ans) = 0;
   virtual bool done() const = 0;
-  virtual bool has_work() = 0;
+  // Weight of the best answer so far; cheap enough for every prune check
+  virtual value_type bound() const = 0;
   virtual const answer_type& answer() const = 0;
 
   virtual ~task_manager() { }
 };
 
 
+// A queue of static type Q behind the virtual interface; q has to
+// outlive the adapter. Q locks itself, so the adapter has no lock.
+template <typename Q>
+class task_queue_adapter : public task_queue<typename Q::task_type> {
+public:
+  typedef task_queue<typename Q::task_type> base_type;
+  typedef typename base_type::task_type task_type;
+  typedef typename base_type::size_type size_type;
+
+  explicit task_queue_adapter(Q &q) : myqueue(q) { }
+
+  void add(const task_type &t) { myqueue.add(t); }
+  bool get(task_type &t) { return myqueue.get(t); }
+  bool steal(task_type &t) { return myqueue.steal(t); }
+  size_type size() { return myqueue.size(); }
+
+private:
+  void get_lock() { }
+  void release_lock() { }
+
+  Q &myqueue;
+};
+
+// A manager of static type M behind the virtual interface; m has to
+// outlive the adapter
+template <typename M>
+class task_manager_adapter :
+    public task_manager<typename M::task_type, typename M::answer_type> {
+public:
+  typedef task_manager<typename M::task_type, typename M::answer_type> base_type;
+  typedef typename base_type::task_type task_type;
+  typedef typename base_type::answer_type answer_type;
+  typedef typename base_type::value_type value_type;
+
+  explicit task_manager_adapter(M &m) : mymanager(m) { }
+
+  bool get(task_type &task) { return mymanager.get(task); }
+  void give(const task_type &task) { mymanager.give(task); }
+  void finish(const task_type &task) { mymanager.finish(task); }
+  void idle() { mymanager.idle(); }
+  bool conclude(const answer_type &ans) { return mymanager.conclude(ans); }
+  bool done() const { return mymanager.done(); }
+  value_type bound() const { return mymanager.bound(); }
+  const answer_type& answer() const { return mymanager.answer(); }
+
+private:
+  M &mymanager;
+};
+
+
 #endif
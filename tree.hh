@@ -6,38 +6,90 @@
 #include <set>
 #include <stdexcept>
 
-class tree {
+// Depth-first traversal, statically polymorphic: tree type D derives
+// from basic_tree<D>, makes it a friend and provides the primitives
+//
+//   size_type level() const         level in the tree (0-based)
+//   size_type whoami() const        child number relative to parent
+//   size_type num_children() const  children attached to the current node
+//   void enqueue(index_type i)      traverse down to child i
+//   void dequeue()                  traverse up to parent
+//
+// and, where it can do better than the defaults below, has_next_sibling()
+// and next_sibling(). The traversal calls them directly, so a search
+// over D inlines the whole step. tree below is the same interface with
+// virtual primitives, for type erasure.
+template <typename D>
+class basic_tree {
 public:
   typedef std::size_t size_type;
   typedef size_type index_type;
 
-  // Level in the tree (0-based)
-  virtual size_type level() const = 0;
-
   // Returns true if the tree has no parent
-  bool is_top() { return level() == 0; }
+  bool is_top() const { return derived().level() == 0; }
 
   // Returns true if the tree has no children
-  bool is_bottom() { return num_children() == 0; }
+  bool is_bottom() const { return derived().num_children() == 0; }
 
   // Returns true if we're on the last branch at this level
-  bool last_branch() { return !has_next_sibling(); }
+  bool last_branch() { return !derived().has_next_sibling(); }
 
   // Go to next branch in the tree traversing up, then to next sibling
   void next_branch() {
     while (last_branch()) {
       if (is_top()) return;
-      dequeue();
+      derived().dequeue();
     }
-    next_sibling();
+    derived().next_sibling();
   }
 
   // Take a step of dfs. If at the bottom with no neighbors, traverse up and onto next branch
   void iterate_dfs() {
-    if (num_children() > 0) enqueue(0);
+    if (derived().num_children() > 0) derived().enqueue(0);
     else next_branch();
   }
 
+protected:
+  ~basic_tree() { }
+
+  // Returns true if the tree has a next sibling. This is a rather
+  // slow implementation, so tree types implementing this iterface can
+  // overwrite it.
+  bool has_next_sibling() {
+    if (is_top()) return false;
+    D &d = derived();
+    index_type myself = d.whoami();
+    d.dequeue();
+    bool has_next = (d.num_children() > myself+1);
+    d.enqueue(myself);
+    return has_next;
+  }
+
+  // Moves current node to next sibling. Tree types that can step there
+  // directly should override this.
+  void next_sibling() {
+    // It is the caller's responsibility to ensure that there actually is a next sibling
+#ifndef NDEBUG
+    if (!derived().has_next_sibling()) throw std::runtime_error("Next child does not exist");
+#endif
+    // if (!has_next_sibling()) return;
+    D &d = derived();
+    index_type next = d.whoami() + 1;
+    d.dequeue();
+    d.enqueue(next);
+  }
+
+private:
+  D& derived() { return static_cast<D&>(*this); }
+  const D& derived() const { return static_cast<const D&>(*this); }
+};
+
+class tree : public basic_tree<tree> {
+  friend class basic_tree<tree>;
+public:
+  // Level in the tree (0-based)
+  virtual size_type level() const = 0;
+
   virtual ~tree() { }
 private:
   // Child number relative to parent
@@ -52,30 +104,29 @@ private:
   // Traverse up to parent
   virtual void dequeue() = 0;
 
-  // Returns true if the tree has a next sibling. This is a rather
-  // slow implementation, so tree types implementing this iterface can
-  // overwrite it.
-  virtual bool has_next_sibling() {
-    if (is_top()) return false;
-    index_type myself = whoami();
-    dequeue();
-    bool has_next = (num_children() > myself+1);
-    enqueue(myself);
-    return has_next;
-  }
+  virtual bool has_next_sibling() { return basic_tree<tree>::has_next_sibling(); }
 
-  // Moves current node to next sibling
-  void next_sibling() {
-    // It is the caller's responsibility to ensure that there actually is a next sibling
-#ifndef NDEBUG
-    if (!has_next_sibling()) throw std::runtime_error("Next child does not exist");
-#endif
-    // if (!has_next_sibling()) return;
-    index_type next = whoami() + 1;
-    dequeue();
-    enqueue(next);
-  }
+  virtual void next_sibling() { basic_tree<tree>::next_sibling(); }
+};
+
+// A tree of static type D behind the virtual interface. D has to be a
+// friend of the adapter and outlive it.
+template <typename D>
+class tree_adapter : public tree {
+public:
+  explicit tree_adapter(D &t) : mytree(t) { }
 
+  size_type level() const { return mytree.level(); }
+
+private:
+  size_type whoami() const { return mytree.whoami(); }
+  size_type num_children() const { return mytree.num_children(); }
+  void enqueue(index_type i) { mytree.enqueue(i); }
+  void dequeue() { mytree.dequeue(); }
+  bool has_next_sibling() { return mytree.has_next_sibling(); }
+  void next_sibling() { mytree.next_sibling(); }
+
+  D &mytree;
 };
 
 #endif